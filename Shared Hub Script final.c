@@ -45,23 +45,37 @@ function handleRequest(e) {
       } catch (err) {}
     }
 
+    if (action === 'triggerUpdates') {
+      return handleTriggerUpdates(params);
+    }
+
+    if (action === 'refreshShard') {
+      return handleRefreshShard(payload);
+    }
+
+    if (action === 'batch') {
+      return handleBatch(token || (payload && payload.token), payload);
+    }
+
     if (!token || !docId) {
       return createResponse({error: 'Invalid token or docId'}, 400);
     }
     
+    // Writes to one doc are serialized by its lock stripe (see withDocLocks)
     switch(action) {
       case 'append':
-        return handleAppend(token, docId, e, payload);
+        return withDocLocks([docId], () => handleAppend(token, docId, e, payload));
+      case 'appendAsync':
+        return withDocLocks([docId], () => handleAppendAsync(token, docId, e, payload));
+      case 'appendStatus':
+        return handleAppendStatus(docId, params, payload);
       case 'setConfig':
       case 'applyStatsSettings':
-        return handleSetConfig(token, docId, params, payload);
+        return withDocLocks([docId], () => handleSetConfig(token, docId, params, payload));
       case 'registerDoc':
-        return handleRegisterDoc(token, docId, params);
+        return withDocLocks([docId], () => handleRegisterDoc(token, docId, params));
       case 'updateStats':
-        const doc = DocumentApp.openById(docId);
-        const config = getDocConfig(token, docId);
-        updateStats(doc, config);
-        return createResponse({success: true, message: 'Stats updated'});
+        return withDocLocks([docId], () => handleUpdateStats(token, docId));
       default:
         return createResponse({error: 'Unknown action: ' + action}, 400);
     }
@@ -72,48 +86,59 @@ function handleRequest(e) {
 }
 
 function handleAppend(token, docId, e, payload) {
-  const doc = DocumentApp.openById(docId);
-  const body = doc.getBody();
-  const config = getDocConfig(token, docId);
-
   const content = e.parameter.text || (e.postData ? e.postData.contents : '');
   if (!content) return createResponse({error: 'No content to append'}, 400);
 
-  const paras = body.getParagraphs();
-  let insertAt = paras.length;
-  if (config.statsBottom && paras.length > 0 && isStatsPara(paras[paras.length - 1])) {
-    insertAt = paras.length - 1;
+  // Retries of an append that already landed are answered without opening the doc
+  const config = getDocConfig(token, docId);
+  const record = loadDocRecord(docId);
+  const dedupeKey = appendDedupeKey(content, e.parameter.idempotencyKey || (payload && payload.idempotencyKey));
+  const nowMs = Date.now();
+  if (findRecentAppend(record, dedupeKey, nowMs)) {
+    return createResponse({ success: true, message: 'Content appended', duplicate: true });
+  }
+
+  // Inside the doc's coalescing window the note waits for the rest of the burst
+  const queue = record.q;
+  if (config.coalesceSeconds > 0 && queue && queue.holdUntil > nowMs && queuedNoteFits(token, content, nowMs)) {
+    const seq = enqueueNote(token, docId, record, content, dedupeKey, nowMs);
+    return createResponse({ success: true, message: 'Note queued', coalesced: true, seq: seq, flushBy: queue.holdUntil });
   }
 
-  // --- THE FIX ---
-  // Insert the separator and content with blank lines for correct spacing.
-  body.insertParagraph(insertAt,     "—");
-  body.insertParagraph(insertAt + 1, ""); // Adds blank line after separator
-  body.insertParagraph(insertAt + 2, content);
-  body.insertParagraph(insertAt + 3, ""); // Adds blank line after content
+  const doc = DocumentApp.openById(docId);
+  // Notes still queued by appendAsync or the coalescing window go in first so arrival order is kept
+  const drained = applyQueuedNotes(docId, doc, config, [content]);
+  rememberAppend(record, dedupeKey, nowMs);
+  if (config.coalesceSeconds > 0) {
+    record.q = record.q || { next: 1, applied: 0 };
+    record.q.holdUntil = nowMs + config.coalesceSeconds * 1000;
+  }
 
-  updateStats(doc, config);
+  const result = updateStats(doc, config);
+  finishQueuedNotes(docId, drained, result);
+  if (result.error || !result.contentChanged) saveDocRecord(docId, record);
   return createResponse({ success: true, message: 'Content appended' });
 }
 
-function handleSetConfig(token, docId, params, payload) {
-  const configKey = 'config_' + token + '_' + docId;
+function handleUpdateStats(token, docId) {
+  const doc = DocumentApp.openById(docId);
   const config = getDocConfig(token, docId);
-  
-  const settingsSource = payload || params;
+  const result = updateStats(doc, config);
+  return createResponse({
+    success: true,
+    message: 'Stats updated',
+    contentChanged: result.contentChanged,
+    changedRanges: result.changedRanges,
+    writes: result.writes,
+    skippedWrites: result.skippedWrites
+  });
+}
 
-  if (settingsSource.statsTop !== undefined) {
-    config.statsTop = settingsSource.statsTop === true || settingsSource.statsTop === 'true';
-  }
-  if (settingsSource.statsBottom !== undefined) {
-    config.statsBottom = settingsSource.statsBottom === true || settingsSource.statsBottom === 'true';
-  }
-  if (settingsSource.statsAnywhere !== undefined) {
-    config.statsAnywhere = settingsSource.statsAnywhere === true || settingsSource.statsAnywhere === 'true';
-  }
-  if (settingsSource.timezone) config.timezone = settingsSource.timezone;
+function handleSetConfig(token, docId, params, payload) {
+  const config = getDocConfig(token, docId);
   
-  PropertiesService.getScriptProperties().setProperty(configKey, JSON.stringify(config));
+  applyConfigSettings(config, payload || params);
+  saveDocConfig(token, docId, config);
   
   const doc = DocumentApp.openById(docId);
   updateStats(doc, config);
@@ -121,65 +146,1434 @@ function handleSetConfig(token, docId, params, payload) {
 }
 
 function handleRegisterDoc(token, docId, params) {
-  const configKey = 'config_' + token + '_' + docId;
   const config = {
     statsTop: params.statsTop === 'true',
     statsBottom: params.statsBottom !== 'false',
     statsAnywhere: params.statsAnywhere === 'true',
     timezone: params.timezone || 'UTC',
+    granularity: DISPLAY_GRANULARITIES.indexOf(params.granularity) !== -1 ? params.granularity : 'seconds',
+    coalesceSeconds: 0,
+    noteLayout: 'standard',
   };
-  PropertiesService.getScriptProperties().setProperty(configKey, JSON.stringify(config));
+  applyConfigSettings(config, { coalesceSeconds: params.coalesceSeconds, noteLayout: params.noteLayout });
+  saveDocConfig(token, docId, config);
+  addToRegistry(token, docId);
   
   const doc = DocumentApp.openById(docId);
   updateStats(doc, config);
   return createResponse({success: true, message: 'Document registered'});
 }
 
+/**
+ * Applies an ordered list of operations in one round trip.
+ * Payload: { mode: 'batch', token, docId?, operations: [{ action, docId?, text?, ...settings }] }
+ * Each document is opened once and updateStats runs once per touched doc at the end. Opening a
+ * doc applies its queued notes; its appends then go in as one block, or are queued like
+ * handleAppend's while the doc's coalescing window is open.
+ */
+function handleBatch(token, payload) {
+  if (!token) {
+    return createResponse({error: 'Invalid token'}, 400);
+  }
+  const operations = (payload && Array.isArray(payload.operations)) ? payload.operations : [];
+  if (operations.length === 0) {
+    return createResponse({error: 'No operations in batch'}, 400);
+  }
+
+  const docIds = operations.map(op => (op && op.docId) || payload.docId).filter(Boolean);
+  return withDocLocks(docIds, () => applyBatch(token, payload, operations));
+}
+
+function applyBatch(token, payload, operations) {
+  const docs = {};      // docId -> { doc, config, drained, pending, appended }
+  const docOrder = [];
+
+  const entryFor = (docId) => {
+    if (!docs[docId]) {
+      docs[docId] = { doc: null, config: getDocConfig(token, docId), drained: null, pending: [], appended: false };
+      docOrder.push(docId);
+    }
+    return docs[docId];
+  };
+  const openEntry = (docId) => {
+    const entry = entryFor(docId);
+    if (!entry.doc) {
+      entry.doc = DocumentApp.openById(docId);
+      // Notes already queued for the doc go in first so arrival order is kept
+      entry.drained = applyQueuedNotes(docId, entry.doc, entry.config);
+    }
+    return entry;
+  };
+  // A doc's appends are inserted as one block, before anything that could move where they land
+  const flushAppends = (docId, entry) => {
+    if (entry.pending.length === 0) return;
+    const pending = entry.pending;
+    entry.pending = [];
+    try {
+      appendNotes(entry.doc.getBody(), entry.config, pending.map(p => p.text));
+      entry.appended = true;
+    } catch (err) {
+      Logger.log('Error appending batch notes for ' + docId + ': ' + err.toString());
+      // Let a retry through rather than answering it as a duplicate
+      const keys = pending.map(p => p.dedupeKey);
+      const record = loadDocRecord(docId);
+      record.rk = (record.rk || []).filter(key => keys.indexOf(key[0]) === -1);
+      pending.forEach(p => {
+        p.result.success = false;
+        p.result.error = err.toString();
+      });
+    }
+  };
+
+  const results = operations.map((op, index) => {
+    const docId = (op && op.docId) || payload.docId;
+    const action = (op && op.action) || 'append';
+    if (!docId) return { index: index, action: action, success: false, error: 'Missing docId' };
+
+    try {
+      switch (action) {
+        case 'append': {
+          if (!op.text) return { index: index, action: action, docId: docId, success: false, error: 'No content to append' };
+          const entry = entryFor(docId);
+          const record = loadDocRecord(docId);
+          const dedupeKey = appendDedupeKey(op.text, op.idempotencyKey);
+          const nowMs = Date.now();
+          if (findRecentAppend(record, dedupeKey, nowMs)) {
+            return { index: index, action: action, docId: docId, success: true, duplicate: true };
+          }
+          // Inside the doc's coalescing window the note waits for the rest of the burst, unless
+          // this batch has already opened the doc
+          const queue = record.q;
+          if (!entry.doc && entry.config.coalesceSeconds > 0 && queue && queue.holdUntil > nowMs &&
+              queuedNoteFits(token, op.text, nowMs)) {
+            const seq = enqueueNote(token, docId, record, op.text, dedupeKey, nowMs);
+            return { index: index, action: action, docId: docId, success: true, coalesced: true, seq: seq, flushBy: queue.holdUntil };
+          }
+          const result = { index: index, action: action, docId: docId, success: true };
+          openEntry(docId).pending.push({ text: op.text, dedupeKey: dedupeKey, result: result });
+          rememberAppend(record, dedupeKey, nowMs);
+          return result;
+        }
+        case 'setConfig':
+        case 'applyStatsSettings': {
+          const entry = openEntry(docId);
+          flushAppends(docId, entry);
+          applyConfigSettings(entry.config, op);
+          saveDocConfig(token, docId, entry.config);
+          break;
+        }
+        case 'updateStats':
+          openEntry(docId);
+          break;
+        default:
+          return { index: index, action: action, docId: docId, success: false, error: 'Unknown action: ' + action };
+      }
+      return { index: index, action: action, docId: docId, success: true };
+    } catch (err) {
+      Logger.log('Error in batch operation ' + index + ' for ' + docId + ': ' + err.toString());
+      return { index: index, action: action, docId: docId, success: false, error: err.toString() };
+    }
+  });
+
+  let statsUpdated = 0;
+  docOrder.forEach(docId => {
+    const entry = docs[docId];
+    if (!entry.doc) return;
+    flushAppends(docId, entry);
+    const record = loadDocRecord(docId);
+    if (entry.appended && entry.config.coalesceSeconds > 0) {
+      record.q = record.q || { next: 1, applied: 0 };
+      record.q.holdUntil = Date.now() + entry.config.coalesceSeconds * 1000;
+    }
+    const result = updateStats(entry.doc, entry.config);
+    finishQueuedNotes(docId, entry.drained, result);
+    if (entry.appended && (result.error || !result.contentChanged)) saveDocRecord(docId, record);
+    statsUpdated++;
+  });
+
+  return createResponse({
+    success: results.every(r => r.success),
+    results: results,
+    statsUpdated: statsUpdated
+  });
+}
+
+// ==================== ASYNC APPEND QUEUE ====================
+
+/*
+ * appendAsync validates a note, stores it as queue_<docId>_<seq> and answers straight away
+ * with its sequence number. Queued notes are applied in seq order, followed by one stats
+ * refresh, by whichever comes first: the drainAppendQueues time-driven trigger, the registry
+ * sweep, or the next synchronous append to the same doc. Docs with pending notes are listed
+ * in the queuedDocs property so the drainer does not need the registry.
+ *
+ * A doc whose config sets coalesceSeconds also routes bursts of synchronous appends through
+ * the queue: an append written straight to the doc opens a window (q.holdUntil), appends
+ * inside it are queued, and the first append or drainer run after it closes inserts the whole
+ * burst with one stats refresh. A note too large to store is written straight away instead.
+ */
+const APPEND_QUEUE_MAX_BYTES = 9 * 1024;   // PropertiesService's limit for one value
+const COALESCE_MAX_SECONDS = 60;
+const QUEUED_DOCS_KEY = 'queuedDocs';
+
+function handleAppendAsync(token, docId, e, payload) {
+  const content = e.parameter.text || (payload && payload.text) || '';
+  if (!content) return createResponse({error: 'No content to append'}, 400);
+  const nowMs = Date.now();
+  if (!queuedNoteFits(token, content, nowMs)) {
+    return createResponse({error: 'Note too large to queue, send it with action=append'}, 413);
+  }
+
+  getDocConfig(token, docId);
+  const record = loadDocRecord(docId);
+  const dedupeKey = appendDedupeKey(content, e.parameter.idempotencyKey || (payload && payload.idempotencyKey));
+  const previous = findRecentAppend(record, dedupeKey, nowMs);
+  if (previous) {
+    return createResponse({ success: true, queued: true, seq: previous[2] || null, duplicate: true });
+  }
+
+  const seq = enqueueNote(token, docId, record, content, dedupeKey, nowMs);
+  return createResponse({ success: true, queued: true, seq: seq, message: 'Note queued' });
+}
+
+/**
+ * Stores content as the doc's next queued note and lists the doc for the drainer. Returns the seq.
+ */
+function enqueueNote(token, docId, record, content, dedupeKey, nowMs) {
+  const queue = record.q = record.q || { next: 1, applied: 0 };
+  const seq = queue.next++;
+  rememberAppend(record, dedupeKey, nowMs, seq);
+
+  const noteProps = {};
+  noteProps[queueNoteKey(docId, seq)] = queuedNoteValue(token, content, nowMs);
+  // The sweep should reach the doc once its coalescing window closes, not at its next stats interval
+  scheduleDocRefresh(docId, record, queue.holdUntil || nowMs);
+  saveDocRecord(docId, record, noteProps);
+  markDocQueued(docId, true);
+  return seq;
+}
+
+/**
+ * Lets the client confirm a queued note has reached the doc: ?action=appendStatus&seq=N
+ */
+function handleAppendStatus(docId, params, payload) {
+  const seq = Number(params.seq || (payload && payload.seq));
+  const queue = loadDocRecord(docId).q || { next: 1, applied: 0 };
+  return createResponse({
+    success: true,
+    seq: Number.isFinite(seq) ? seq : null,
+    applied: Number.isFinite(seq) && seq > 0 && seq <= queue.applied,
+    lastApplied: queue.applied,
+    pending: Math.max(queue.next - 1 - queue.applied, 0)
+  });
+}
+
+function queuedNoteValue(token, content, nowMs) {
+  return JSON.stringify({ t: token, text: content, at: nowMs });
+}
+
+// The limit is on the stored JSON's UTF-8 bytes, not the note's characters: emoji and CJK take
+// 3-4 bytes each
+function queuedNoteFits(token, content, nowMs) {
+  return Utilities.newBlob(queuedNoteValue(token, content, nowMs)).getBytes().length <= APPEND_QUEUE_MAX_BYTES;
+}
+
+function queueNoteKey(docId, seq) {
+  return 'queue_' + docId + '_' + seq;
+}
+
+/**
+ * Inserts every pending queued note into doc, in seq order. The caller must hold the doc's lock,
+ * run updateStats, then call finishQueuedNotes.
+ * Returns { applied, token, keys } where token is the first note's (for config lookup).
+ */
+function applyQueuedNotes(docId, doc, tailConfig, tailContents) {
+  const record = loadDocRecord(docId);
+  const queue = record.q;
+  const drained = { applied: 0, token: null, keys: [] };
+  // Consecutive notes that land in the same place are inserted as one run
+  const runs = [];
+  const addToRuns = (config, content) => {
+    const last = runs[runs.length - 1];
+    if (last && last.config.statsBottom === config.statsBottom && last.config.noteLayout === config.noteLayout) {
+      last.contents.push(content);
+    } else {
+      runs.push({ config: config, contents: [content] });
+    }
+  };
+
+  const lastQueued = queue ? queue.next - 1 : 0;
+  if (queue && queue.applied < lastQueued) {
+    const props = PropertiesService.getScriptProperties();
+    for (let seq = queue.applied + 1; seq <= lastQueued; seq++) {
+      const key = queueNoteKey(docId, seq);
+      drained.keys.push(key);
+      const raw = props.getProperty(key);
+      if (!raw) {
+        Logger.log('applyQueuedNotes: missing queued note ' + key);
+        continue;
+      }
+      const note = JSON.parse(raw);
+      drained.token = drained.token || note.t;
+      addToRuns(getDocConfig(note.t, docId), note.text);
+      drained.applied++;
+    }
+  }
+  (tailContents || []).forEach(content => addToRuns(tailConfig, content));
+
+  const body = doc.getBody();
+  runs.forEach(run => appendNotes(body, run.config, run.contents));
+  // Only once the notes are in the doc; a failed insert leaves them queued
+  if (drained.keys.length > 0) queue.applied = lastQueued;
+  return drained;
+}
+
+/**
+ * Makes the new applied seq durable (updateStats normally persists it with the content change),
+ * then deletes the applied notes and unlists the doc.
+ */
+function finishQueuedNotes(docId, drained, statsResult) {
+  if (drained.keys.length === 0) return;
+  if (statsResult.error || !statsResult.contentChanged) {
+    saveDocRecord(docId, loadDocRecord(docId));
+  }
+  const props = PropertiesService.getScriptProperties();
+  drained.keys.forEach(key => props.deleteProperty(key));
+  markDocQueued(docId, false);
+}
+
+/**
+ * Opens a doc, applies any queued notes and refreshes its stats. Caller holds the doc's lock.
+ * Without a token the config comes from the first queued note, else from the doc's record.
+ */
+function refreshDoc(docId, token) {
+  const doc = DocumentApp.openById(docId);
+  const drained = applyQueuedNotes(docId, doc);
+  const configToken = token || drained.token || storedDocToken(loadDocRecord(docId));
+  if (!configToken) {
+    // Rendering under a made-up token would save a default config and show it in the doc
+    finishQueuedNotes(docId, drained, { contentChanged: false });
+    return { skipped: true, queuedApplied: drained.applied };
+  }
+  const result = updateStats(doc, getDocConfig(configToken, docId));
+  finishQueuedNotes(docId, drained, result);
+  result.queuedApplied = drained.applied;
+  return result;
+}
+
+function markDocQueued(docId, queued) {
+  const scriptLock = LockService.getScriptLock();
+  if (!scriptLock.tryLock(DOC_LOCK_MAX_WAIT_MS)) {
+    Logger.log('markDocQueued: script lock unavailable for ' + docId);
+    return;
+  }
+  try {
+    const props = PropertiesService.getScriptProperties();
+    const docIds = JSON.parse(props.getProperty(QUEUED_DOCS_KEY) || '[]');
+    const position = docIds.indexOf(docId);
+    if (queued && position === -1) {
+      docIds.push(docId);
+    } else if (!queued && position !== -1) {
+      docIds.splice(position, 1);
+    } else {
+      return;
+    }
+    props.setProperty(QUEUED_DOCS_KEY, JSON.stringify(docIds));
+  } finally {
+    scriptLock.releaseLock();
+  }
+}
+
+/**
+ * Time-driven trigger entry point (see installAppendQueueTrigger): applies queued notes
+ * for every listed doc within the sweep time budget.
+ */
+function drainAppendQueues() {
+  const startMs = Date.now();
+  const budgetMs = getSweepBudgetMs();
+  const docIds = JSON.parse(PropertiesService.getScriptProperties().getProperty(QUEUED_DOCS_KEY) || '[]');
+  const summary = { docs: 0, notes: 0, busy: 0, held: 0, circuitOpen: 0, failed: 0 };
+
+  for (let i = 0; i < docIds.length && Date.now() - startMs < budgetMs; i++) {
+    const docId = docIds[i];
+    if (isCircuitOpen(loadDocRecord(docId), Date.now())) {
+      summary.circuitOpen++;
+      continue;
+    }
+    const lease = acquireDocLocks([docId], 0);
+    if (!lease) {
+      summary.busy++;
+      continue;
+    }
+    try {
+      forgetDocRecord(docId);
+      const queue = loadDocRecord(docId).q;
+      if (queue && queue.holdUntil > Date.now()) {
+        // Still inside its coalescing window; the burst is flushed on a later run
+        summary.held++;
+        continue;
+      }
+      const result = refreshDoc(docId, null);
+      if (result.error) {
+        summary.failed++;
+        Logger.log('drainAppendQueues: failed for ' + docId + ': ' + result.error);
+        forgetDocRecord(docId);
+        if (!result.revisionConflict) recordDocFailure(docId, result.error);
+        continue;
+      }
+      summary.docs++;
+      summary.notes += result.queuedApplied;
+    } catch (err) {
+      summary.failed++;
+      Logger.log('drainAppendQueues: failed for ' + docId + ': ' + err.toString());
+      forgetDocRecord(docId);   // drop any half-applied in-memory state before recording the failure
+      recordDocFailure(docId, err);
+    } finally {
+      releaseDocLocks(lease);
+    }
+  }
+  flushDueWheel();
+  Logger.log('drainAppendQueues: ' + JSON.stringify(summary));
+  return summary;
+}
+
+/**
+ * Run once from the editor to drain the append queue every minute.
+ */
+function installAppendQueueTrigger() {
+  const exists = ScriptApp.getProjectTriggers().some(t => t.getHandlerFunction() === 'drainAppendQueues');
+  if (!exists) {
+    ScriptApp.newTrigger('drainAppendQueues').timeBased().everyMinutes(1).create();
+  }
+}
+
+// ==================== PER-DOC LOCKS ====================
+
+/*
+ * LockService only offers one script-wide lock, so per-doc mutual exclusion is built on top:
+ * docIds hash onto DOC_LOCK_STRIPES stripes, and each stripe is a lease in the script cache
+ * that is claimed or released while briefly holding the script lock. Unrelated docs (almost
+ * always on different stripes) proceed in parallel, writes to the same doc serialize, and a
+ * holder that dies simply lets its lease expire.
+ *
+ * Apps Script cannot renew a lease while fn runs, so the lease outlasts the 6 min execution
+ * limit: a holder either releases it in withDocLocks' finally or is killed by the timeout
+ * before it expires, and two executions never hold a stripe at once. The cost is that a lease
+ * left behind by a timed-out execution (or a failed release) blocks its stripe until it expires.
+ */
+const DOC_LOCK_STRIPES = 32;
+const DOC_LOCK_LEASE_S = 6 * 60 + 30;   // execution time limit plus margin for clock skew
+const DOC_LOCK_MAX_WAIT_MS = 5000;
+const DOC_LOCK_POLL_MS = 200;
+const DOC_LOCK_RETRY_AFTER_MS = 2000;
+
+let heldLockKeys_ = {};   // stripe keys this execution holds a lease on
+
+/**
+ * Runs fn while holding the stripes for docIds, or returns a busy response
+ * (with retryAfterMs) if they cannot be claimed within DOC_LOCK_MAX_WAIT_MS.
+ */
+function withDocLocks(docIds, fn) {
+  const lease = acquireDocLocks(docIds, DOC_LOCK_MAX_WAIT_MS);
+  if (!lease) {
+    return createResponse({
+      success: false,
+      busy: true,
+      error: 'Document is busy, retry later',
+      retryAfterMs: DOC_LOCK_RETRY_AFTER_MS + Math.floor(Math.random() * DOC_LOCK_RETRY_AFTER_MS)
+    }, 409);
+  }
+  try {
+    return fn();
+  } finally {
+    // Flushed while the lease is still held (see unfileDueAdds), but released even if that throws
+    try {
+      flushDueWheel();
+    } finally {
+      releaseDocLocks(lease);
+    }
+  }
+}
+
+function docLockStripe(docId) {
+  return fnv1a32(docId) % DOC_LOCK_STRIPES;
+}
+
+function fnv1a32(text) {
+  let hash = 0x811c9dc5;
+  for (let i = 0; i < text.length; i++) {
+    hash = Math.imul(hash ^ text.charCodeAt(i), 0x01000193);
+  }
+  return hash >>> 0;
+}
+
+/**
+ * Claims every stripe covering docIds, in ascending order so multi-doc callers cannot deadlock.
+ * Returns a lease { owner, keys } or null after maxWaitMs (0 = a single attempt).
+ */
+function acquireDocLocks(docIds, maxWaitMs) {
+  const stripes = [];
+  docIds.forEach(docId => {
+    const stripe = docLockStripe(docId);
+    if (stripes.indexOf(stripe) === -1) stripes.push(stripe);
+  });
+  stripes.sort((a, b) => a - b);
+
+  const lease = { owner: Utilities.getUuid(), keys: [] };
+  const deadline = Date.now() + maxWaitMs;
+  for (let i = 0; i < stripes.length; i++) {
+    const key = 'docLock_' + stripes[i];
+    while (!claimLockStripe(key, lease.owner)) {
+      if (Date.now() + DOC_LOCK_POLL_MS > deadline) {
+        releaseDocLocks(lease);
+        return null;
+      }
+      Utilities.sleep(DOC_LOCK_POLL_MS);
+    }
+    lease.keys.push(key);
+    heldLockKeys_[key] = true;
+  }
+  return lease;
+}
+
+function claimLockStripe(key, owner) {
+  const scriptLock = LockService.getScriptLock();
+  if (!scriptLock.tryLock(DOC_LOCK_POLL_MS)) return false;
+  try {
+    const cache = CacheService.getScriptCache();
+    if (cache.get(key)) return false;
+    cache.put(key, owner, DOC_LOCK_LEASE_S);
+    return true;
+  } finally {
+    scriptLock.releaseLock();
+  }
+}
+
+function releaseDocLocks(lease) {
+  if (!lease || lease.keys.length === 0) return;
+  const scriptLock = LockService.getScriptLock();
+  if (!scriptLock.tryLock(DOC_LOCK_MAX_WAIT_MS)) {
+    Logger.log('releaseDocLocks: script lock unavailable, leases will expire on their own');
+    return;
+  }
+  try {
+    const cache = CacheService.getScriptCache();
+    lease.keys.forEach(key => {
+      if (cache.get(key) === lease.owner) cache.remove(key);
+      delete heldLockKeys_[key];
+    });
+    lease.keys = [];
+  } finally {
+    scriptLock.releaseLock();
+  }
+}
+
+/**
+ * Drops the execution-local copy of a doc record so it is re-read after taking the doc's lock.
+ */
+function forgetDocRecord(docId) {
+  delete docRecords_[docId];
+}
+
+// ==================== SCHEDULER (triggerUpdates) ====================
+
+// Default leaves headroom under the cron workflow's 90 s curl timeout.
+// Override with the 'sweepBudgetMs' script property (capped below the 6 min execution limit).
+const SWEEP_DEFAULT_BUDGET_MS = 75 * 1000;
+const SWEEP_MAX_BUDGET_MS     = 5 * 60 * 1000;
+const SWEEP_CURSOR_KEY        = 'sweepCursor';
+// Phases run in order over the registry; the cursor records which one a paused sweep was in.
+const SWEEP_PHASES            = ['stats'];
+
+// Adaptive refresh cadence. updateStats stores each doc's next due time (record st.nd):
+// every REFRESH_LIVE_INTERVAL_MS while Live, then an interval that doubles as time away
+// grows (kept at or under half the time away), capped at REFRESH_MAX_INTERVAL_MS.
+// An edit or append makes the doc Live again, so the sweep only refreshes docs that are due.
+const REFRESH_LIVE_INTERVAL_MS = 60 * 1000;
+const REFRESH_MAX_INTERVAL_MS  = 60 * 60 * 1000;
+// Docs due this soon count as due, so a sweep doesn't leave them for one more cron period.
+const REFRESH_DUE_SLACK_MS     = 30 * 1000;
+
+/**
+ * Refreshes stats for the docs in the registry sheet that are due (force=true: all of them).
+ * Called by the auto-update workflow: ?action=triggerUpdates&apiKey=...
+ */
+function handleTriggerUpdates(params) {
+  if (!isRegistryApiKey(params.apiKey)) {
+    return createResponse({error: 'Unauthorized'}, 401);
+  }
+  return createResponse(runSweep(getSweepBudgetMs(), params.force === 'true'));
+}
+
+function isRegistryApiKey(apiKey) {
+  const expectedKey = PropertiesService.getScriptProperties().getProperty('registryApiKey');
+  return !!expectedKey && apiKey === expectedKey;
+}
+
+function getSweepBudgetMs() {
+  const configured = readNumberProperty(PropertiesService.getScriptProperties(), 'sweepBudgetMs');
+  if (configured === null || configured <= 0) return SWEEP_DEFAULT_BUDGET_MS;
+  return Math.min(configured, SWEEP_MAX_BUDGET_MS);
+}
+
+/**
+ * Time-budgeted, resumable pass over the registry.
+ * Stops before the next doc would overrun the budget, saves a { phase, row } cursor,
+ * and the next invocation continues from there. A finished pass clears the cursor.
+ * Docs whose refresh is not yet due are skipped unless force is set.
+ * scope (optional, see runShardTrigger) limits the sweep to one partition of the docs:
+ * { suffix: for its own cursor and seeding keys, ownsDoc: docId -> boolean }.
+ */
+function runSweep(budgetMs, force, scope) {
+  const props = PropertiesService.getScriptProperties();
+  const startMs = Date.now();
+  scope = scope || { suffix: '', ownsDoc: null };
+  const cursorKey = SWEEP_CURSOR_KEY + scope.suffix;
+  const seededAtKey = DUE_SEEDED_AT_KEY + scope.suffix;
+
+  const cursor = readSweepCursor(props, cursorKey);
+  if (cursor.leaseUntil && cursor.leaseUntil > startMs) {
+    return { success: true, busy: true, message: 'Another sweep is running' };
+  }
+  cursor.leaseUntil = startMs + budgetMs;
+  cursor.passStartedAt = cursor.passStartedAt || startMs;
+  writeSweepCursor(props, cursorKey, cursor);
+
+  // Once a registry pass has filed every doc in the due wheel, sweeps pop just the docs that
+  // are due; a full pass still runs daily to re-file anything the wheel lost.
+  const seededAt = readNumberProperty(props, seededAtKey);
+  if (!force && cursor.row === 0 && seededAt !== null && startMs - seededAt < DUE_RESEED_INTERVAL_MS) {
+    const dueResult = runDueSweep(budgetMs, startMs, scope.ownsDoc);
+    props.deleteProperty(cursorKey);
+    return dueResult;
+  }
+
+  const entries = loadRegistryEntries().filter(entry => !scope.ownsDoc || scope.ownsDoc(entry.docId));
+  preloadDocRecords(entries.map(entry => entry.docId));
+  const summary = { updated: 0, failed: 0, busy: 0, notDue: 0, circuitOpen: 0, writes: 0, skippedWrites: 0 };
+  let processed = 0;
+  let slowestMs = 0;
+  let paused = false;
+
+  for (let p = SWEEP_PHASES.indexOf(cursor.phase); p < SWEEP_PHASES.length && !paused; p++) {
+    const phase = SWEEP_PHASES[p];
+    if (phase !== cursor.phase) {
+      cursor.phase = phase;
+      cursor.row = 0;
+    }
+    for (let i = 0; i < entries.length; i++) {
+      const entry = entries[i];
+      if (entry.row < cursor.row) continue;
+
+      // Stop early if one more doc at the slowest observed pace would overrun the budget.
+      if (Date.now() - startMs + slowestMs > budgetMs) {
+        paused = true;
+        cursor.row = entry.row;
+        break;
+      }
+      const docStartMs = Date.now();
+      runSweepPhase(phase, entry, summary, force);
+      slowestMs = Math.max(slowestMs, Date.now() - docStartMs);
+      processed++;
+    }
+  }
+
+  const result = {
+    success: true,
+    total: entries.length,
+    processed: processed,
+    updated: summary.updated,
+    failed: summary.failed,
+    busy: summary.busy,
+    notDue: summary.notDue,
+    circuitOpen: summary.circuitOpen,
+    writes: summary.writes,
+    skippedWrites: summary.skippedWrites,
+    complete: !paused,
+    elapsedMs: Date.now() - startMs
+  };
+
+  flushDueWheel();
+  if (paused) {
+    cursor.leaseUntil = 0;
+    writeSweepCursor(props, cursorKey, cursor);
+    result.resumeFrom = { phase: cursor.phase, row: cursor.row };
+    Logger.log('runSweep: budget reached, resuming next run at ' + cursor.phase + ' row ' + cursor.row);
+  } else {
+    result.passElapsedMs = Date.now() - cursor.passStartedAt;
+    props.deleteProperty(cursorKey);
+    // Every registered doc in scope is now filed in the due wheel; later sweeps use it
+    props.setProperty(seededAtKey, String(cursor.passStartedAt));
+  }
+  return result;
+}
+
+/**
+ * Sweep over the docs popped from the due wheel. Docs left when the budget runs out are
+ * filed again as due now, so the next sweep picks them up first. With sweepConcurrency > 1
+ * the docs are refreshed by parallel shards (see dispatchRefreshShards).
+ */
+function runDueSweep(budgetMs, startMs, ownsDoc) {
+  const docIds = popDueDocs(startMs, ownsDoc);
+  const concurrency = Math.min(getSweepConcurrency(), docIds.length);
+  let summary;
+  let shards = null;
+  if (concurrency > 1) {
+    const dispatched = dispatchRefreshShards(docIds, concurrency, budgetMs, startMs);
+    summary = dispatched.summary;
+    shards = dispatched.shards;
+  } else {
+    summary = refreshDueDocs(docIds, budgetMs, startMs);
+  }
+  flushDueWheel();
+
+  const result = {
+    success: true,
+    due: docIds.length,
+    processed: summary.processed,
+    updated: summary.updated,
+    failed: summary.failed,
+    busy: summary.busy,
+    notDue: summary.notDue,
+    circuitOpen: summary.circuitOpen,
+    deferred: summary.deferred,
+    writes: summary.writes,
+    skippedWrites: summary.skippedWrites,
+    complete: summary.deferred === 0,
+    elapsedMs: Date.now() - startMs
+  };
+  if (shards) result.shards = shards;
+  return result;
+}
+
+const REFRESH_SUMMARY_FIELDS = ['processed', 'updated', 'failed', 'busy', 'notDue', 'circuitOpen', 'deferred', 'writes', 'skippedWrites'];
+
+/**
+ * Refreshes popped docs in order within the budget; the rest are filed as due now.
+ */
+function refreshDueDocs(docIds, budgetMs, startMs) {
+  preloadDocRecords(docIds);
+  const summary = {};
+  REFRESH_SUMMARY_FIELDS.forEach(field => { summary[field] = 0; });
+  let slowestMs = 0;
+
+  docIds.forEach(docId => {
+    if (Date.now() - startMs + slowestMs > budgetMs) {
+      fileDocRefresh(docId, startMs);
+      summary.deferred++;
+      return;
+    }
+    const token = storedDocToken(loadDocRecord(docId));
+    if (!token) return;   // no config left for this doc: let it drop out of the wheel
+    const docStartMs = Date.now();
+    runSweepPhase('stats', { docId: docId, token: token }, summary, false);
+    slowestMs = Math.max(slowestMs, Date.now() - docStartMs);
+    summary.processed++;
+  });
+  return summary;
+}
+
+// ---------- Parallel shards ----------
+
+// Set the 'sweepConcurrency' script property above 1 to refresh due docs in that many
+// parallel executions: the sweep POSTs each shard to this web app (mode refreshShard,
+// authenticated with the registry key) through one UrlFetchApp.fetchAll call.
+// A shard's budget stays under UrlFetchApp's 60 s response deadline.
+const SWEEP_MAX_CONCURRENCY = 8;
+const SHARD_MAX_BUDGET_MS = 50 * 1000;
+const SHARD_DISPATCH_OVERHEAD_MS = 5 * 1000;
+
+function getSweepConcurrency() {
+  const configured = readNumberProperty(PropertiesService.getScriptProperties(), 'sweepConcurrency');
+  if (configured === null || configured < 1) return 1;
+  return Math.min(Math.floor(configured), SWEEP_MAX_CONCURRENCY);
+}
+
+/**
+ * Splits docIds round-robin into shards, runs them concurrently and sums their summaries.
+ * A shard that fails outright, every shard when fetchAll itself throws, and every shard when
+ * too little budget is left to dispatch have their docs filed as due now.
+ * Returns { summary, shards: [{ docs, updated, failed, elapsedMs } | { docs, error }] }.
+ */
+function dispatchRefreshShards(docIds, concurrency, budgetMs, startMs) {
+  const shardDocIds = [];
+  for (let i = 0; i < concurrency; i++) shardDocIds.push([]);
+  docIds.forEach((docId, i) => shardDocIds[i % concurrency].push(docId));
+
+  const apiKey = PropertiesService.getScriptProperties().getProperty('registryApiKey');
+  const url = ScriptApp.getService().getUrl();
+  const shardBudgetMs = Math.min(budgetMs - (Date.now() - startMs) - SHARD_DISPATCH_OVERHEAD_MS, SHARD_MAX_BUDGET_MS);
+  const summary = {};
+  REFRESH_SUMMARY_FIELDS.forEach(field => { summary[field] = 0; });
+  if (shardBudgetMs <= 0) {
+    // Not enough budget left to be worth a round trip: leave every doc for the next sweep
+    docIds.forEach(docId => fileDocRefresh(docId, Date.now()));
+    summary.deferred = docIds.length;
+    return { summary: summary, shards: [] };
+  }
+
+  const requests = shardDocIds.map(ids => ({
+    url: url,
+    method: 'post',
+    contentType: 'application/json',
+    payload: JSON.stringify({ mode: 'refreshShard', apiKey: apiKey, docIds: ids, budgetMs: shardBudgetMs }),
+    muteHttpExceptions: true
+  }));
+  let responses;
+  try {
+    responses = UrlFetchApp.fetchAll(requests);
+  } catch (e) {
+    // Timeout or network error: no shard result is known, so every doc goes back as due now
+    Logger.log('dispatchRefreshShards: fetchAll failed: ' + e.toString());
+    docIds.forEach(docId => fileDocRefresh(docId, Date.now()));
+    summary.deferred = docIds.length;
+    return { summary: summary, shards: shardDocIds.map(ids => ({ docs: ids.length, error: e.toString() })) };
+  }
+
+  const shards = responses.map((response, i) => {
+    let result = null;
+    try {
+      if (response.getResponseCode() === 200) result = JSON.parse(response.getContentText());
+    } catch (e) {}
+
+    if (!result || !result.success) {
+      const error = (result && result.error) || ('HTTP ' + response.getResponseCode());
+      Logger.log('dispatchRefreshShards: shard ' + i + ' failed: ' + error);
+      shardDocIds[i].forEach(docId => fileDocRefresh(docId, Date.now()));
+      summary.deferred += shardDocIds[i].length;
+      return { docs: shardDocIds[i].length, error: error };
+    }
+    REFRESH_SUMMARY_FIELDS.forEach(field => { summary[field] += result[field] || 0; });
+    return { docs: shardDocIds[i].length, updated: result.updated, failed: result.failed, elapsedMs: result.elapsedMs };
+  });
+  return { summary: summary, shards: shards };
+}
+
+/**
+ * One parallel shard: POST { mode: 'refreshShard', apiKey, docIds, budgetMs }.
+ */
+function handleRefreshShard(payload) {
+  if (!payload || !isRegistryApiKey(payload.apiKey)) {
+    return createResponse({error: 'Unauthorized'}, 401);
+  }
+  const startMs = Date.now();
+  const docIds = (payload.docIds || []).map(String);
+  // The dispatching sweep already popped these docs' wheel entries
+  docIds.forEach(docId => { poppedDocs_[docId] = true; });
+  // An explicit budget of 0 means defer everything, so only a missing or bad value gets the maximum
+  const requestedMs = Number(payload.budgetMs);
+  const budgetMs = Number.isFinite(requestedMs) ? Math.min(Math.max(requestedMs, 0), SHARD_MAX_BUDGET_MS) : SHARD_MAX_BUDGET_MS;
+
+  const summary = refreshDueDocs(docIds, budgetMs, startMs);
+  flushDueWheel();
+  summary.success = true;
+  summary.elapsedMs = Date.now() - startMs;
+  return createResponse(summary);
+}
+
+function runSweepPhase(phase, entry, summary, force) {
+  switch (phase) {
+    case 'stats': {
+      const record = loadDocRecord(entry.docId);
+      if (!force && isCircuitOpen(record, Date.now())) {
+        // Failing doc still backing off: re-probed once record.br.until passes
+        fileDocRefresh(entry.docId, record.br.until);
+        summary.circuitOpen++;
+        break;
+      }
+      if (!force && !isRefreshDue(record, Date.now())) {
+        // Make sure it is filed in the due wheel (first pass, or popped early by a lazy entry)
+        fileDocRefresh(entry.docId, record.st.nd);
+        summary.notDue++;
+        break;
+      }
+      // Registry rows may leave the token blank; use one the doc's config is stored under
+      const token = entry.token || storedDocToken(record);
+      if (!token) {
+        Logger.log('runSweep: no token for ' + entry.docId + ', skipped');
+        break;
+      }
+      // A doc being written right now gets its stats refreshed (and is re-filed) by that request
+      const lease = acquireDocLocks([entry.docId], 0);
+      if (!lease) {
+        summary.busy++;
+        break;
+      }
+      try {
+        forgetDocRecord(entry.docId);
+        const result = refreshDoc(entry.docId, token);
+        if (result.error) {
+          // updateStats reports its own failures without rescheduling, and this doc's wheel entry
+          // is already popped. A revision conflict (doc being edited) is retried soon; anything
+          // else counts against the circuit breaker, which also files the next probe.
+          summary.failed++;
+          Logger.log('runSweep: stats failed for ' + entry.docId + ': ' + result.error);
+          forgetDocRecord(entry.docId);
+          const failedRecord = loadDocRecord(entry.docId);
+          if (!result.revisionConflict) {
+            recordDocFailure(entry.docId, result.error);
+          } else if (scheduleDocRefresh(entry.docId, failedRecord, Date.now() + REFRESH_LIVE_INTERVAL_MS)) {
+            saveDocRecord(entry.docId, failedRecord, null, false);
+          }
+          break;
+        }
+        summary.updated++;
+        summary.writes += result.writes || 0;
+        summary.skippedWrites += result.skippedWrites || 0;
+      } catch (err) {
+        summary.failed++;
+        Logger.log('runSweep: stats failed for ' + entry.docId + ': ' + err.toString());
+        forgetDocRecord(entry.docId);   // drop any half-applied in-memory state before recording the failure
+        recordDocFailure(entry.docId, err);
+      } finally {
+        releaseDocLocks(lease);
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * Time until a doc's next refresh: see REFRESH_LIVE_INTERVAL_MS.
+ */
+function refreshIntervalMs(elapsedMs) {
+  let interval = REFRESH_LIVE_INTERVAL_MS;
+  while (interval * 2 <= elapsedMs / 2 && interval * 2 <= REFRESH_MAX_INTERVAL_MS) interval *= 2;
+  return interval;
+}
+
+/**
+ * A doc's next refresh: no sooner than its cadence allows or its text would change,
+ * and no later than REFRESH_MAX_INTERVAL_MS so edits typed into the doc are still noticed.
+ */
+function nextRefreshDueMs(lastChangeMs, nowMs, granularity) {
+  const cadenceDue = nowMs + refreshIntervalMs(Math.max(nowMs - lastChangeMs, 0));
+  const visibleDue = nextVisibleChangeMs(lastChangeMs, nowMs, granularity);
+  return Math.min(Math.max(cadenceDue, visibleDue), nowMs + REFRESH_MAX_INTERVAL_MS);
+}
+
+function isRefreshDue(record, nowMs) {
+  const queue = record.q;
+  if (queue && queue.applied < queue.next - 1) return true;   // queued notes are waiting
+  return !record.st || !Number.isFinite(record.st.nd) || record.st.nd <= nowMs + REFRESH_DUE_SLACK_MS;
+}
+
+function readSweepCursor(props, key) {
+  const fresh = { phase: SWEEP_PHASES[0], row: 0, passStartedAt: 0, leaseUntil: 0 };
+  const raw = props.getProperty(key);
+  if (!raw) return fresh;
+  try {
+    const cursor = JSON.parse(raw);
+    if (SWEEP_PHASES.indexOf(cursor.phase) === -1) return fresh;
+    return cursor;
+  } catch (err) {
+    Logger.log('Invalid sweep cursor, starting a new pass: ' + raw);
+    return fresh;
+  }
+}
+
+function writeSweepCursor(props, key, cursor) {
+  props.setProperty(key, JSON.stringify(cursor));
+}
+
+/**
+ * Reads the registry sheet (first sheet of registrySheetId).
+ * Columns are located by a 'docId' / 'token' header row; without one, A = docId and B = token.
+ * Returns one entry per docId (first row wins).
+ */
+function loadRegistryEntries() {
+  const sheetId = PropertiesService.getScriptProperties().getProperty('registrySheetId');
+  if (!sheetId) {
+    Logger.log('loadRegistryEntries: registrySheetId is not set');
+    return [];
+  }
+  return readRegistryEntries(SpreadsheetApp.openById(sheetId).getSheets()[0].getDataRange().getValues());
+}
+
+function readRegistryEntries(rows) {
+  if (rows.length === 0) return [];
+  const columns = registryColumns(rows[0]);
+  const docCol = columns.docCol;
+  const tokenCol = columns.tokenCol;
+
+  const seen = {};
+  const entries = [];
+  for (let r = columns.firstRow; r < rows.length; r++) {
+    const docId = String(rows[r][docCol] || '').trim();
+    if (!docId || seen[docId]) continue;
+    seen[docId] = true;
+    entries.push({
+      row: r + 1,
+      docId: docId,
+      token: tokenCol >= 0 ? String(rows[r][tokenCol] || '').trim() : ''
+    });
+  }
+  return entries;
+}
+
+/**
+ * Column positions from the registry's first row: { docCol, tokenCol, firstRow }.
+ * tokenCol is -1 when the header row has no 'token' column.
+ */
+function registryColumns(firstRowValues) {
+  const header = firstRowValues.map(v => String(v).trim().toLowerCase());
+  const docCol = header.indexOf('docid');
+  if (docCol === -1) return { docCol: 0, tokenCol: 1, firstRow: 0 };
+  return { docCol: docCol, tokenCol: header.indexOf('token'), firstRow: 1 };
+}
+
+/**
+ * Adds a docId/token pair to the registry sheet if the doc is not already listed,
+ * in the columns loadRegistryEntries reads them from.
+ */
+function addToRegistry(token, docId) {
+  try {
+    const sheetId = PropertiesService.getScriptProperties().getProperty('registrySheetId');
+    if (!sheetId) return;
+    const sheet = SpreadsheetApp.openById(sheetId).getSheets()[0];
+    const rows = sheet.getDataRange().getValues();
+    const alreadyListed = readRegistryEntries(rows).some(entry => entry.docId === docId);
+    if (!alreadyListed) {
+      const columns = registryColumns(rows[0] || []);
+      const row = new Array(Math.max(columns.docCol, columns.tokenCol) + 1).fill('');
+      row[columns.docCol] = docId;
+      if (columns.tokenCol >= 0) row[columns.tokenCol] = token;
+      sheet.appendRow(row);
+    }
+  } catch (err) {
+    Logger.log('addToRegistry failed for ' + docId + ': ' + err.toString());
+  }
+}
+
+// ==================== SHARD TRIGGERS ====================
+
+/*
+ * In-script replacement for the external cron: installShardTriggers(n) creates n time-driven
+ * triggers running runShardTrigger every SHARD_TRIGGER_MINUTES. Shard k owns the docs with
+ * fnv1a32(docId) % n === k and sweeps them with its own cursor and due-wheel pops.
+ * Each run stamps shardHeartbeat_<k>. A shard whose heartbeat is older than SHARD_STALE_MS
+ * (trigger disabled, quota, repeated timeouts) has its partition adopted by the next live
+ * shard in ring order until it beats again.
+ * The auto-update workflow can still call triggerUpdates as an optional external kick.
+ */
+const SHARD_TRIGGER_HANDLER = 'runShardTrigger';
+const SHARD_TRIGGERS_KEY = 'shardTriggers';     // { count, uids: { triggerUid: shard } }
+const SHARD_HEARTBEAT_PREFIX = 'shardHeartbeat_';
+const SHARD_TRIGGER_MINUTES = 5;
+const SHARD_STALE_MS = 3 * SHARD_TRIGGER_MINUTES * 60 * 1000;
+const SHARD_MAX_COUNT = 10;
+
+/**
+ * Run once from the editor (again to change the count). Replaces existing shard triggers.
+ */
+function installShardTriggers(count) {
+  count = Math.max(1, Math.min(Math.floor(Number(count) || 1), SHARD_MAX_COUNT));
+  removeShardTriggers();
+  const props = PropertiesService.getScriptProperties();
+  const uids = {};
+  const nowMs = Date.now();
+  for (let shard = 0; shard < count; shard++) {
+    const trigger = ScriptApp.newTrigger(SHARD_TRIGGER_HANDLER).timeBased().everyMinutes(SHARD_TRIGGER_MINUTES).create();
+    uids[trigger.getUniqueId()] = shard;
+    props.setProperty(SHARD_HEARTBEAT_PREFIX + shard, String(nowMs));   // grace period until its first run
+  }
+  props.setProperty(SHARD_TRIGGERS_KEY, JSON.stringify({ count: count, uids: uids }));
+  Logger.log('installShardTriggers: ' + count + ' shard triggers installed');
+}
+
+function removeShardTriggers() {
+  ScriptApp.getProjectTriggers()
+    .filter(trigger => trigger.getHandlerFunction() === SHARD_TRIGGER_HANDLER)
+    .forEach(trigger => ScriptApp.deleteTrigger(trigger));
+  const props = PropertiesService.getScriptProperties();
+  const config = readShardConfig(props);
+  if (config) {
+    for (let shard = 0; shard < config.count; shard++) props.deleteProperty(SHARD_HEARTBEAT_PREFIX + shard);
+  }
+  props.deleteProperty(SHARD_TRIGGERS_KEY);
+}
+
+/**
+ * Time-driven trigger entry point: sweeps this shard's partition plus any adopted ones.
+ */
+function runShardTrigger(e) {
+  const props = PropertiesService.getScriptProperties();
+  const config = readShardConfig(props);
+  const shard = config && e && e.triggerUid !== undefined ? config.uids[e.triggerUid] : undefined;
+  if (shard === undefined) {
+    Logger.log('runShardTrigger: trigger ' + (e && e.triggerUid) + ' is not a registered shard');
+    return;
+  }
+
+  const nowMs = Date.now();
+  props.setProperty(SHARD_HEARTBEAT_PREFIX + shard, String(nowMs));
+  const owned = ownedShardPartitions(props, config.count, shard, nowMs);
+  const result = runSweep(getSweepBudgetMs(), false, {
+    suffix: '_shard' + shard,
+    ownsDoc: docId => owned.indexOf(fnv1a32(docId) % config.count) !== -1
+  });
+  props.setProperty(SHARD_HEARTBEAT_PREFIX + shard, String(Date.now()));
+  Logger.log('runShardTrigger ' + shard + ' (partitions ' + owned.join(',') + '): ' + JSON.stringify(result));
+}
+
+/**
+ * This shard's partition, plus each stale partition whose next live successor is this shard.
+ */
+function ownedShardPartitions(props, count, shard, nowMs) {
+  const live = [];
+  for (let k = 0; k < count; k++) {
+    const heartbeat = readNumberProperty(props, SHARD_HEARTBEAT_PREFIX + k);
+    live.push(k === shard || (heartbeat !== null && nowMs - heartbeat < SHARD_STALE_MS));
+  }
+  const owned = [shard];
+  for (let k = 0; k < count; k++) {
+    if (live[k]) continue;
+    for (let step = 1; step < count; step++) {
+      const successor = (k + step) % count;
+      if (live[successor]) {
+        if (successor === shard) owned.push(k);
+        break;
+      }
+    }
+  }
+  return owned;
+}
+
+function readShardConfig(props) {
+  try {
+    const config = JSON.parse(props.getProperty(SHARD_TRIGGERS_KEY) || 'null');
+    return config && config.count > 0 && config.uids ? config : null;
+  } catch (e) {
+    return null;
+  }
+}
+
+// ==================== DOC CIRCUIT BREAKER ====================
+
+/*
+ * Docs whose refresh keeps failing (deleted, access revoked, Docs API errors) stop costing
+ * every sweep an openById. Both thrown errors and { error } results from updateStats count,
+ * except a docsApi revision conflict, which only means the doc is being edited. Each
+ * consecutive failure doubles the back-off from BREAKER_BASE_BACKOFF_MS, up to
+ * BREAKER_MAX_BACKOFF_MS. After BREAKER_QUARANTINE_FAILURES the doc is quarantined and only
+ * probed every BREAKER_PROBE_INTERVAL_MS. Once the back-off passes, the circuit is half-open:
+ * the next sweep makes a single probe refresh. A success (any updateStats, including one from a
+ * request) closes the circuit; another failure re-opens it for longer.
+ */
+const BREAKER_BASE_BACKOFF_MS = 10 * 60 * 1000;
+const BREAKER_MAX_BACKOFF_MS = 6 * 60 * 60 * 1000;
+const BREAKER_QUARANTINE_FAILURES = 5;
+const BREAKER_PROBE_INTERVAL_MS = 24 * 60 * 60 * 1000;
+
+function isCircuitOpen(record, nowMs) {
+  return !!record.br && Number.isFinite(record.br.until) && record.br.until > nowMs;
+}
+
+function recordDocFailure(docId, err) {
+  const nowMs = Date.now();
+  const record = loadDocRecord(docId);
+  const breaker = record.br || { f: 0 };
+  breaker.f++;
+  breaker.q = breaker.f >= BREAKER_QUARANTINE_FAILURES;
+  const backoffMs = breaker.q
+    ? BREAKER_PROBE_INTERVAL_MS
+    : Math.min(BREAKER_BASE_BACKOFF_MS * Math.pow(2, breaker.f - 1), BREAKER_MAX_BACKOFF_MS);
+  breaker.until = nowMs + backoffMs;
+  breaker.e = String(err).slice(0, 200);
+  record.br = breaker;
+  if (breaker.q) {
+    Logger.log('Doc ' + docId + ' quarantined after ' + breaker.f + ' failures, next probe ' + new Date(breaker.until).toISOString());
+  }
+
+  // Its due-wheel entry was popped for this attempt: file the probe
+  poppedDocs_[docId] = true;
+  scheduleDocRefresh(docId, record, breaker.until);
+  saveDocRecord(docId, record);
+}
+
+/**
+ * Lists docs with an open or half-open circuit. Run from the editor.
+ */
+function listBrokenDocs() {
+  const props = PropertiesService.getScriptProperties();
+  const broken = props.getKeys()
+    .filter(key => key.startsWith('doc_'))
+    .map(key => ({ docId: key.substring('doc_'.length), record: parseDocRecord(key, props.getProperty(key)) }))
+    .filter(item => item.record.br)
+    .map(item => ({
+      docId: item.docId,
+      failures: item.record.br.f,
+      quarantined: !!item.record.br.q,
+      nextProbe: new Date(item.record.br.until).toISOString(),
+      lastError: item.record.br.e
+    }));
+  Logger.log(JSON.stringify(broken, null, 2));
+  return broken;
+}
+
+// ==================== DUE WHEEL ====================
+
+/*
+ * Calendar queue of refresh due times (see nextRefreshDueMs), so a sweep only touches docs
+ * that are due instead of reading the whole registry. Bucket b covers DUE_BUCKET_MS and is
+ * stored as due_<b> = [docId, ...]; dueIndex lists the non-empty buckets in order. Both are
+ * changed only under the script lock.
+ * A doc is filed once, under its earliest wake-up (record field wb). A later due time leaves
+ * that entry alone and the doc is re-filed when it pops early (lazy deletion), so most
+ * refreshes don't write to the wheel at all. Additions are buffered per execution and
+ * written by flushDueWheel.
+ */
+const DUE_BUCKET_MS = 60 * 1000;
+const DUE_INDEX_KEY = 'dueIndex';
+const DUE_SEEDED_AT_KEY = 'dueWheelSeededAt';
+const DUE_RESEED_INTERVAL_MS = 24 * 60 * 60 * 1000;
+const DUE_BUCKET_MAX_CHARS = 8000;
+
+let pendingDueAdds_ = {};   // bucket -> docIds not yet written
+let poppedDocs_ = {};       // docIds whose wheel entry was popped in this execution
+
+/**
+ * Files docId to be refreshed at dueMs unless it already has an earlier pending entry.
+ * Returns true if record.wb changed (the caller saves the record).
+ */
+function scheduleDocRefresh(docId, record, dueMs) {
+  const bucket = Math.floor(dueMs / DUE_BUCKET_MS);
+  const pending = Number.isFinite(record.wb) && !poppedDocs_[docId] &&
+    record.wb >= Math.floor(Date.now() / DUE_BUCKET_MS);
+  if (pending && record.wb <= bucket) return false;
+  delete poppedDocs_[docId];
+  record.wb = bucket;
+  (pendingDueAdds_[bucket] = pendingDueAdds_[bucket] || []).push(docId);
+  return true;
+}
+
+/**
+ * scheduleDocRefresh for a caller that does not hold docId's lock. The record is re-read and
+ * saved only under a lease claimed without waiting, so a stale (e.g. preloaded) q, rk or cfg
+ * never overwrites what a lock holder just wrote. A doc whose lock is taken is left for the
+ * holder's updateStats or the daily reseed to file.
+ */
+function fileDocRefresh(docId, dueMs) {
+  const lease = acquireDocLocks([docId], 0);
+  if (!lease) return false;
+  try {
+    forgetDocRecord(docId);
+    const record = loadDocRecord(docId);
+    if (scheduleDocRefresh(docId, record, dueMs)) saveDocRecord(docId, record, null, false);
+    return true;
+  } finally {
+    releaseDocLocks(lease);
+  }
+}
+
+function flushDueWheel() {
+  const adds = pendingDueAdds_;
+  if (Object.keys(adds).length === 0) return;
+  pendingDueAdds_ = {};
+
+  const scriptLock = LockService.getScriptLock();
+  if (!scriptLock.tryLock(DOC_LOCK_MAX_WAIT_MS)) {
+    Logger.log('flushDueWheel: script lock unavailable, dropped ' + JSON.stringify(adds));
+    unfileDueAdds(adds);
+    return;
+  }
+  try {
+    const props = PropertiesService.getScriptProperties();
+    const index = readDueIndex(props);
+    const buckets = {};
+    Object.keys(adds).forEach(key => {
+      adds[key].forEach(docId => {
+        // A full bucket spills into the next one
+        let bucket = Number(key);
+        for (;;) {
+          if (!buckets[bucket]) buckets[bucket] = JSON.parse(props.getProperty('due_' + bucket) || '[]');
+          if (buckets[bucket].indexOf(docId) !== -1) break;
+          if (JSON.stringify(buckets[bucket]).length + docId.length + 3 <= DUE_BUCKET_MAX_CHARS) {
+            buckets[bucket].push(docId);
+            break;
+          }
+          bucket++;
+        }
+      });
+    });
+
+    const toWrite = {};
+    Object.keys(buckets).forEach(bucket => {
+      toWrite['due_' + bucket] = JSON.stringify(buckets[bucket]);
+      if (index.indexOf(Number(bucket)) === -1) index.push(Number(bucket));
+    });
+    index.sort((a, b) => a - b);
+    toWrite[DUE_INDEX_KEY] = JSON.stringify(index);
+    props.setProperties(toWrite);
+  } finally {
+    scriptLock.releaseLock();
+  }
+}
+
+/**
+ * Clears record.wb for wheel additions that could not be written, so each doc's next
+ * scheduleDocRefresh files it again instead of taking the saved wb as pending. A record is
+ * only written under its doc's lock, one this execution holds or claims without waiting;
+ * anything else is left for the daily reseed.
+ */
+function unfileDueAdds(adds) {
+  Object.keys(adds).forEach(key => {
+    adds[key].forEach(docId => {
+      const held = !!heldLockKeys_['docLock_' + docLockStripe(docId)];
+      const lease = held ? null : acquireDocLocks([docId], 0);
+      if (!held && !lease) return;
+      try {
+        if (!held) forgetDocRecord(docId);
+        const record = loadDocRecord(docId);
+        if (record.wb === Number(key)) {
+          delete record.wb;
+          saveDocRecord(docId, record, null, false);
+        }
+      } finally {
+        if (lease) releaseDocLocks(lease);
+      }
+    });
+  });
+}
+
+/**
+ * Removes and returns the docIds in every bucket due by nowMs (plus REFRESH_DUE_SLACK_MS).
+ * With ownsDoc, only the docs it accepts are taken; the rest stay in their buckets.
+ */
+function popDueDocs(nowMs, ownsDoc) {
+  const scriptLock = LockService.getScriptLock();
+  if (!scriptLock.tryLock(DOC_LOCK_MAX_WAIT_MS)) {
+    Logger.log('popDueDocs: script lock unavailable');
+    return [];
+  }
+  try {
+    const props = PropertiesService.getScriptProperties();
+    const index = readDueIndex(props);
+    const lastDue = Math.floor((nowMs + REFRESH_DUE_SLACK_MS) / DUE_BUCKET_MS);
+    const docIds = [];
+    const remaining = index.filter(bucket => bucket > lastDue);
+    index.filter(bucket => bucket <= lastDue).forEach(bucket => {
+      const left = [];
+      JSON.parse(props.getProperty('due_' + bucket) || '[]').forEach(docId => {
+        if (ownsDoc && !ownsDoc(docId)) {
+          left.push(docId);
+        } else if (!poppedDocs_[docId]) {
+          poppedDocs_[docId] = true;
+          docIds.push(docId);
+        }
+      });
+      if (left.length > 0) {
+        props.setProperty('due_' + bucket, JSON.stringify(left));
+        remaining.push(bucket);
+      } else {
+        props.deleteProperty('due_' + bucket);
+      }
+    });
+    remaining.sort((a, b) => a - b);
+    props.setProperty(DUE_INDEX_KEY, JSON.stringify(remaining));
+    return docIds;
+  } finally {
+    scriptLock.releaseLock();
+  }
+}
+
+function readDueIndex(props) {
+  try {
+    const index = JSON.parse(props.getProperty(DUE_INDEX_KEY) || '[]');
+    return Array.isArray(index) ? index : [];
+  } catch (e) {
+    return [];
+  }
+}
+
 // ==================== CORE STATS LOGIC (FINAL FLEXIBLE VERSION) ====================
 
+const ANYWHERE_MARKERS = ['⏳', '⏳️', '⌛️'];
+const PRIMARY_ANYWHERE_MARKER = '⏳';
+// A doc counts as 'Live' until this long after its last edit.
+const LIVE_WINDOW_MS = 2 * 60 * 1000;
+// Per-doc 'granularity' config values; see displayUnitMs.
+const DISPLAY_GRANULARITIES = ['seconds', 'minutes', 'adaptive'];
+// Per-doc 'noteLayout' config values; see buildNoteBlock.
+const NOTE_LAYOUTS = ['standard', 'compact'];
+
 /**
    * Computes the stats block and timers for a doc.
-   * Uses a SHA-256 hash of the clean user content to detect edits reliably.
+   * Uses per-block hashes of the clean user content (see computeContentHash) to detect edits reliably.
+   * Returns { contentChanged, changedRanges } (or { error }) for callers that report it.
    */
   function updateStats(doc, config) {
     try {
-      const body = doc.getBody();
+      const docId = doc.getId();
 
-      // Trim blank paragraphs at the top so stats sit neatly
-      let paras = body.getParagraphs();
-      while (paras.length > 0 && paras[0].getText().trim() === '') {
-        safeRemovePara(paras[0]);
-        paras = body.getParagraphs();
+      // The docsApi backend reads paragraph ranges and text runs through the Docs API instead of
+      // DocumentApp proxies; DocumentApp edits made earlier in this execution are saved first.
+      let structure = null;
+      if (getRenderBackendName() === 'docsApi') {
+        doc.saveAndClose();
+        structure = readDocStructure(docId);
       }
 
-      if (paras.length === 0 && !config.statsTop && !config.statsBottom && !config.statsAnywhere) {
-        return;
-      }
+      // One scan classifies every paragraph; all phases below reuse and patch this index.
+      const index = structure ? buildStructureIndex(structure) : buildParagraphIndex(doc.getBody());
 
-      const props = PropertiesService.getScriptProperties();
-      const docId = doc.getId();
+      // Paragraph writes go through the deployment's render backend (see createStatsRenderer).
+      // writes / skippedWrites count stats writes made vs. skipped because the text already matched.
+      const render = createStatsRenderer(doc, structure);
 
-      const lastContentHashKey = 'lastContentHash_' + docId;
-      const lastChangeTimeKey  = 'lastChangeTime_'  + docId;
-      const longestTimeKey     = 'longestTime_'     + docId;
-      const lastLiveTimeKey    = 'lastLiveTime_'    + docId;
+      // Trim blank paragraphs at the top so stats sit neatly
+      trimLeadingBlanks(index, render);
 
-      const lastStoredHash = props.getProperty(lastContentHashKey) || null;
-      let lastChangeTimeMs = readNumberProperty(props, lastChangeTimeKey);
-      let longestTime     = readNumberProperty(props, longestTimeKey) || 0;
-      let lastLiveTimeMs  = readNumberProperty(props, lastLiveTimeKey);
+      if (index.length === 0 && !config.statsTop && !config.statsBottom && !config.statsAnywhere) {
+        render.commit();
+        return { contentChanged: false, changedRanges: [], writes: 0, skippedWrites: 0, visibleChange: false };
+      }
 
-      // Remove existing stats blocks so we only hash user content
-      const fullText = body.getText();
-      const cleanText = fullText.replace(
-        /[⏰⏳⌛️⏳️][\s\S]*?Status: .*?(?:\n|$)/g,
-        ''
-      );
+      const props = PropertiesService.getScriptProperties();
+      const contentBlocksKey = 'contentBlocks_' + docId;
 
-      const currentHash = computeContentHash(cleanText);
-      const contentChanged = !lastStoredHash || lastStoredHash !== currentHash;
+      // Config and timer state share one record, read once per execution (see loadDocRecord)
+      const record = loadDocRecord(docId);
+      const state = readDocState(docId, record);
+      const lastStoredHash = state.h || null;
+      let lastChangeTimeMs = Number.isFinite(state.c) ? state.c : null;
+      let longestTime     = Number.isFinite(state.l) ? state.l : 0;
+      let lastLiveTimeMs  = Number.isFinite(state.lv) ? state.lv : null;
 
       const nowMs = Date.now();
+      const contentTexts = contentParagraphTexts(index);
+
+      // Tier 1: paragraph count, total length and a head/tail sample. When these match and
+      // no periodic verification is due, the content is taken as unchanged without hashing it.
+      const storedFingerprint = (state.fp && Number.isFinite(state.fp.verifiedAt)) ? state.fp : null;
+      const fingerprint = contentFingerprint(contentTexts);
+      const verifyDue = !storedFingerprint || nowMs - storedFingerprint.verifiedAt >= getHashVerifyIntervalMs();
+      const runFullHash = !lastStoredHash || verifyDue || !sameFingerprint(storedFingerprint, fingerprint);
+
+      // Tier 2: hash user content (stats paragraphs excluded) block by block from the index
+      let contentChanged = false;
+      let changedRanges = [];
+      let contentBlocks = null;
+      let currentHash = lastStoredHash;
+      if (runFullHash) {
+        const storedBlocks = readContentBlocks(props, contentBlocksKey);
+        contentBlocks = buildContentBlocks(contentTexts, storedBlocks ? storedBlocks.size : CONTENT_BLOCK_SIZE);
+        currentHash = contentRootHash(contentBlocks);
+
+        // A stored hash without a block vector, or from another hash engine, can't be compared:
+        // re-baseline instead of reporting an edit, so upgrades don't reset every Last edit timer.
+        const baselineKnown = !!storedBlocks && (storedBlocks.alg || 'sha256') === contentBlocks.alg;
+        contentChanged = baselineKnown ? lastStoredHash !== currentHash : !lastStoredHash;
+        changedRanges = contentChanged ? diffContentBlocks(baselineKnown ? storedBlocks : null, contentBlocks) : [];
+
+        if (contentBlocks.blocks.length > CONTENT_BLOCK_LIMIT) {
+          contentBlocks = buildContentBlocks(contentTexts, blockSizeFor(contentTexts.length));
+          currentHash = contentRootHash(contentBlocks);
+        }
+        fingerprint.verifiedAt = nowMs;
+      } else {
+        fingerprint.verifiedAt = storedFingerprint.verifiedAt;
+      }
 
       if (contentChanged || lastChangeTimeMs === null) {
         lastChangeTimeMs = nowMs;
@@ -188,119 +1582,505 @@ function handleRegisterDoc(token, docId, params) {
         lastLiveTimeMs = nowMs;
       }
 
-      const elapsedTime     = Math.max(nowMs - lastChangeTimeMs, 0);
-      const newLongestTime  = Math.max(longestTime, elapsedTime);
-      const tz              = config.timezone || 'UTC';
-      const timestampStr    = Utilities.formatDate(new Date(lastChangeTimeMs), tz, 'dd/MM/yyyy hh:mm:ss a');
-      const status          = elapsedTime < 2 * 60 * 1000 ? 'Live' : 'Away';
+      const elapsedTime     = Math.max(nowMs - lastChangeTimeMs, 0);
+      const newLongestTime  = Math.max(longestTime, elapsedTime);
+      const tz              = config.timezone || 'UTC';
+      const timestampStr    = Utilities.formatDate(new Date(lastChangeTimeMs), tz, 'dd/MM/yyyy hh:mm:ss a');
+      const status          = elapsedTime < LIVE_WINDOW_MS ? 'Live' : 'Away';
+      const granularity     = config.granularity || 'seconds';
+      const elapsedStr      = formatElapsedTime(elapsedTime, displayUnitMs(granularity, elapsedTime));
+      const longestStr      = formatElapsedTime(newLongestTime, displayUnitMs(granularity, newLongestTime));
+
+      const clockStatsText =
+        '⏰\n' +
+        `Last edit: ${timestampStr} — ${elapsedStr} ago\n` +
+        `Longest time away: ${longestStr}\n` +
+        `Status: ${status}`;
+
+      const sandTimerStatsText =
+        '⏳\r\n' +
+        `Last edit: ${timestampStr} — ${elapsedStr} ago\n` +
+        `Longest time away: ${longestStr}\n` +
+        `Status: ${status}`;
+
+      // Top placement
+      const topEntry = (index.length > 0 && index[0].clock) ? index[0] : null;
+      if (config.statsTop) {
+        if (topEntry) {
+          setIndexedText(topEntry, clockStatsText, render);
+        } else {
+          index.unshift(render.insertTop(clockStatsText));
+          render.writes++;
+        }
+      } else if (topEntry) {
+        removeIndexedPara(index, 0, render);
+      }
+
+      // Bottom placement
+      const topIsNowStats = index.length > 0 && index[0].clock;
+      let bottomFound = false;
+      for (let i = index.length - 1; i >= (topIsNowStats ? 1 : 0); i--) {
+        if (index[i].clock) {
+          if (config.statsBottom) {
+            setIndexedText(index[i], clockStatsText, render);
+          } else {
+            removeIndexedPara(index, i, render);
+          }
+          bottomFound = true;
+          break;
+        }
+      }
+      if (!bottomFound && config.statsBottom) {
+        index.push(render.append(clockStatsText));
+        render.writes++;
+      }
+
+      // Anywhere stats
+      if (config.statsAnywhere === true) {
+        for (let i = 0; i < index.length; i++) {
+          const entry = index[i];
+          if (entry.sandMarker && !entry.renderedStats) {
+            setIndexedText(entry, sandTimerStatsText, render);
+          }
+        }
+      } else {
+        for (let i = 0; i < index.length; i++) {
+          const text = index[i].text;
+          if (text.startsWith(PRIMARY_ANYWHERE_MARKER + '\n') ||
+              text.startsWith(PRIMARY_ANYWHERE_MARKER + '\r') ||
+              text.startsWith(PRIMARY_ANYWHERE_MARKER + ' ')) {
+            setIndexedText(index[i], PRIMARY_ANYWHERE_MARKER, render);
+          }
+        }
+      }
+
+      // Apply queued writes before persisting, so a failed render leaves the state untouched
+      render.commit();
+
+      // Persist state (and the block vector when it was rebuilt) in one setProperties call.
+      // Timer-only updates are written behind through the cache (see saveDocRecord).
+      lastLiveTimeMs = lastLiveTimeMs !== null ? lastLiveTimeMs : nowMs;
+      let durableChange = currentHash !== state.h || lastChangeTimeMs !== state.c;
+      if (record.br) {
+        // The doc is reachable again: close its circuit breaker
+        delete record.br;
+        durableChange = true;
+      }
+      record.st = {
+        h: currentHash, c: lastChangeTimeMs, l: newLongestTime, lv: lastLiveTimeMs, fp: fingerprint,
+        nd: nextRefreshDueMs(lastChangeTimeMs, nowMs, granularity)
+      };
+      scheduleDocRefresh(docId, record, record.st.nd);
+      const extraProps = {};
+      if (contentBlocks && currentHash !== state.h) extraProps[contentBlocksKey] = JSON.stringify(contentBlocks);
+      saveDocRecord(docId, record, extraProps, durableChange);
+
+      return {
+        contentChanged: contentChanged,
+        changedRanges: changedRanges,
+        fullHash: runFullHash,
+        writes: render.writes,
+        skippedWrites: render.skippedWrites,
+        visibleChange: render.writes > 0
+      };
+
+    } catch (e) {
+      Logger.log('CRITICAL Error in updateStats: ' + e.toString() + ' Stack: ' + e.stack);
+      return { error: e.toString(), revisionConflict: !!e.revisionConflict };
+    }
+  }
+
+  /**
+   * Reads every paragraph once and records what updateStats needs to know about it.
+   * Placement phases keep the returned array in sync via setIndexedText/removeIndexedPara
+   * and by splicing in entries for inserted paragraphs, so the body is never re-scanned.
+   */
+  function buildParagraphIndex(body) {
+    return body.getParagraphs().map((para, ordinal) => {
+      const entry = classifyParagraph(para);
+      entry.ordinal = ordinal;   // position at scan time; the docsApi backend addresses paragraphs by it
+      return entry;
+    });
+  }
+
+  /**
+   * Same entries as buildParagraphIndex, from a readDocStructure result.
+   * para is null; range carries the paragraph's Docs API indexes.
+   */
+  function buildStructureIndex(structure) {
+    return structure.paragraphs.map((range, ordinal) => {
+      const entry = describeParagraph(null, range.text, range.isParagraph);
+      entry.ordinal = ordinal;
+      entry.range = range;
+      return entry;
+    });
+  }
+
+  function classifyParagraph(para) {
+    let text = '';
+    let isParagraph = false;
+    try {
+      text = para.getText();
+      isParagraph = para.getType() === DocumentApp.ElementType.PARAGRAPH;
+    } catch (e) {}
+    return describeParagraph(para, text, isParagraph);
+  }
+
+  function describeParagraph(para, text, isParagraph) {
+    return {
+      para: para,
+      text: text,
+      isParagraph: isParagraph,
+      blank: text.trim() === '',
+      statsOnly: isStatsOnlyText(text),
+      clock: isParagraph && text.startsWith('⏰'),   // same test as isStatsPara
+      sandMarker: ANYWHERE_MARKERS.some(marker => text.includes(marker)),
+      renderedStats: text.includes('Last edit:')
+    };
+  }
+
+  /**
+   * Removes the whole run of leading blank paragraphs in one pass over the index.
+   * Like safeRemovePara, a paragraph Docs refuses to remove (the body's or a cell's last one)
+   * is cleared instead, so when the run is the entire document its final paragraph is kept.
+   * Returns the number of paragraphs detached.
+   */
+  function trimLeadingBlanks(index, render) {
+    let run = 0;
+    while (run < index.length && index[run].blank) run++;
+    if (run === 0) return 0;
+
+    const kept = [];
+    for (let i = 0; i < run; i++) {
+      if (!render.remove(index[i])) kept.push(clearIndexedEntry(index[i]));
+    }
+
+    index.splice.apply(index, [0, run].concat(kept));
+    return run - kept.length;
+  }
+
+  /**
+   * Writes text to an indexed paragraph unless it already shows exactly that text.
+   * Each skipped setText saves a Docs write and a revision-history entry.
+   */
+  function setIndexedText(entry, text, render) {
+    if (renderedTextMatches(entry.text, text)) {
+      render.skippedWrites++;
+      return;
+    }
+    render.setText(entry, text);
+    render.writes++;
+    const updated = describeParagraph(entry.para, text, entry.isParagraph);
+    Object.keys(updated).forEach(key => { entry[key] = updated[key]; });
+  }
+
+  function removeIndexedPara(index, i, render) {
+    render.writes++;
+    if (render.remove(index[i])) {
+      index.splice(i, 1);
+    } else {
+      clearIndexedEntry(index[i]);
+    }
+  }
+
+  // A paragraph that could not be detached was cleared instead
+  function clearIndexedEntry(entry) {
+    const updated = describeParagraph(entry.para, '', entry.isParagraph);
+    Object.keys(updated).forEach(key => { entry[key] = updated[key]; });
+    return entry;
+  }
+
+  /**
+   * Docs stores line breaks inside a paragraph as '\r', so '\n' / '\r\n' in what we wrote
+   * read back differently. Compare with every run of line breaks collapsed.
+   */
+  function renderedTextMatches(current, desired) {
+    const normalize = text => String(text).replace(/[\r\n]+/g, '\n');
+    return normalize(current) === normalize(desired);
+  }
+
+  // ---------- Content hashing ----------
+
+  // Paragraphs per hashed block, and the most blocks stored before the block size doubles
+  // (keeps the contentBlocks_ property well under the 9 KB value limit).
+  const CONTENT_BLOCK_SIZE = 64;
+  const CONTENT_BLOCK_LIMIT = 128;
+  const CONTENT_BLOCK_HASH_CHARS = 16;
+
+  /**
+   * True for paragraphs that hold nothing but stats: a rendered block or a bare ⏰/⏳/⌛ marker.
+   * These change as updateStats renders, so they are left out of the content hash.
+   */
+  function isStatsOnlyText(text) {
+    if (text.trim() === '') return false;
+    let rest = stripStatsBlocks(text);
+    ANYWHERE_MARKERS.concat(['⏰', '⌛', '\uFE0F']).forEach(marker => { rest = rest.split(marker).join(''); });
+    return rest.trim() === '';
+  }
+
+  /**
+   * Clean text of every user paragraph, in document order.
+   */
+  function contentParagraphTexts(index) {
+    const texts = [];
+    for (let i = 0; i < index.length; i++) {
+      if (!index[i].statsOnly) texts.push(stripStatsBlocks(index[i].text));
+    }
+    return texts;
+  }
+
+  /**
+   * Splits paragraph texts into fixed-size blocks and hashes each one.
+   * Returns { v, alg, n, size, blocks: [[charLength, hash], ...] }.
+   */
+  function buildContentBlocks(texts, size) {
+    const blocks = [];
+    for (let start = 0; start < texts.length; start += size) {
+      const blockText = texts.slice(start, start + size).join('\n');
+      blocks.push([blockText.length, computeContentHash(blockText).slice(0, CONTENT_BLOCK_HASH_CHARS)]);
+    }
+    return { v: 1, alg: getHashEngineName(), n: texts.length, size: size, blocks: blocks };
+  }
+
+  function blockSizeFor(paragraphCount) {
+    let size = CONTENT_BLOCK_SIZE;
+    while (Math.ceil(paragraphCount / size) > CONTENT_BLOCK_LIMIT) size *= 2;
+    return size;
+  }
+
+  /**
+   * Document-level hash derived from the block vector (stored as st.h in the doc record).
+   */
+  function contentRootHash(contentBlocks) {
+    return computeContentHash(contentBlocks.n + ':' + contentBlocks.blocks.map(b => b[0] + '.' + b[1]).join(','));
+  }
+
+  /**
+   * Paragraph ranges [{ start, end }] (end exclusive, counting user paragraphs only)
+   * whose blocks differ between two vectors built with the same block size.
+   */
+  function diffContentBlocks(previous, current) {
+    if (!previous || previous.size !== current.size) {
+      return current.n > 0 ? [{ start: 0, end: current.n }] : [];
+    }
+    const ranges = [];
+    const count = Math.max(previous.blocks.length, current.blocks.length);
+    for (let b = 0; b < count; b++) {
+      const before = previous.blocks[b];
+      const after = current.blocks[b];
+      if (before && after && before[0] === after[0] && before[1] === after[1]) continue;
+
+      const start = b * current.size;
+      const end = Math.max(Math.min((b + 1) * current.size, Math.max(previous.n, current.n)), start);
+      const last = ranges[ranges.length - 1];
+      if (last && last.end === start) {
+        last.end = end;
+      } else {
+        ranges.push({ start: start, end: end });
+      }
+    }
+    return ranges;
+  }
+
+  // Paragraphs sampled from each end of the document for the tier-1 fingerprint.
+  const FINGERPRINT_SAMPLE_PARAS = 3;
+  // Default for the 'hashVerifyIntervalMs' script property: how long a matching fingerprint
+  // is trusted before the full block hash runs anyway as a backstop.
+  const HASH_VERIFY_INTERVAL_MS = 30 * 60 * 1000;
+
+  /**
+   * Cheap structural fingerprint of the user content: { alg, n, len, sample }.
+   */
+  function contentFingerprint(texts) {
+    let len = 0;
+    for (let i = 0; i < texts.length; i++) len += texts[i].length;
+    const head = texts.slice(0, FINGERPRINT_SAMPLE_PARAS);
+    const tail = texts.length > FINGERPRINT_SAMPLE_PARAS ? texts.slice(-FINGERPRINT_SAMPLE_PARAS) : [];
+    return {
+      alg: getHashEngineName(),
+      n: texts.length,
+      len: len,
+      sample: computeContentHash(head.join('\n') + '\u0000' + tail.join('\n')).slice(0, CONTENT_BLOCK_HASH_CHARS)
+    };
+  }
+
+  function sameFingerprint(a, b) {
+    return !!a && !!b && a.alg === b.alg && a.n === b.n && a.len === b.len && a.sample === b.sample;
+  }
+
+  function readFingerprint(props, key) {
+    const raw = props.getProperty(key);
+    if (!raw) return null;
+    try {
+      const parsed = JSON.parse(raw);
+      return (parsed && Number.isFinite(parsed.verifiedAt)) ? parsed : null;
+    } catch (e) {
+      return null;
+    }
+  }
+
+  let hashVerifyIntervalMs_ = null;
 
-      const clockStatsText =
-        '⏰\n' +
-        `Last edit: ${timestampStr} — ${formatElapsedTime(elapsedTime)} ago\n` +
-        `Longest time away: ${formatElapsedTime(newLongestTime)}\n` +
-        `Status: ${status}`;
+  function getHashVerifyIntervalMs() {
+    if (hashVerifyIntervalMs_ === null) {
+      const configured = readNumberProperty(PropertiesService.getScriptProperties(), 'hashVerifyIntervalMs');
+      hashVerifyIntervalMs_ = configured !== null && configured >= 0 ? configured : HASH_VERIFY_INTERVAL_MS;
+    }
+    return hashVerifyIntervalMs_;
+  }
 
-      const sandTimerStatsText =
-        '⏳\r\n' +
-        `Last edit: ${timestampStr} — ${formatElapsedTime(elapsedTime)} ago\n` +
-        `Longest time away: ${formatElapsedTime(newLongestTime)}\n` +
-        `Status: ${status}`;
+  function readContentBlocks(props, key) {
+    const raw = props.getProperty(key);
+    if (!raw) return null;
+    try {
+      const parsed = JSON.parse(raw);
+      return (parsed && Array.isArray(parsed.blocks) && parsed.size > 0) ? parsed : null;
+    } catch (e) {
+      Logger.log('Invalid content block vector for ' + key);
+      return null;
+    }
+  }
 
-      // Top placement
-      let topPara = (paras.length > 0 && isStatsPara(paras[0])) ? paras[0] : null;
-      if (config.statsTop) {
-        if (topPara) {
-          topPara.setText(clockStatsText);
-        } else {
-          body.insertParagraph(0, clockStatsText);
-        }
-      } else if (topPara) {
-        safeRemovePara(topPara);
-      }
+  // Code points that can open a rendered stats block: ⏰ U+23F0, ⏳ U+23F3, ⌛ U+231B.
+  const STATS_MARKER_CODES = [0x23F0, 0x23F3, 0x231B];
+  const VARIATION_SELECTOR_16 = 0xFE0F;
+  // A rendered block is: marker(s), 'Last edit:' line, optional 'Longest time away:' line, 'Status:' line.
+  const STATS_BLOCK_MAX_LINES = 3;
 
-      // Bottom placement
-      const updatedParas = body.getParagraphs();
-      const topIsNowStats = updatedParas.length > 0 && isStatsPara(updatedParas[0]);
-      let bottomFound = false;
-      for (let i = updatedParas.length - 1; i >= (topIsNowStats ? 1 : 0); i--) {
-        if (isStatsPara(updatedParas[i])) {
-          if (config.statsBottom) {
-            updatedParas[i].setText(clockStatsText);
-          } else {
-            safeRemovePara(updatedParas[i]);
-          }
-          bottomFound = true;
-          break;
-        }
+  /**
+   * Removes rendered clock and sand-timer stats blocks from text in a single forward pass.
+   * Replaces the old /[⏰⏳⌛️⏳️][\s\S]*?Status: .*?(?:\n|$)/ regex, which rescanned from every
+   * marker and treated a bare U+FE0F as a marker. A block only matches when the marker is
+   * followed by 'Last edit:' and a 'Status: ' line within the next few lines, so lookahead is bounded.
+   */
+  function stripStatsBlocks(text) {
+    if (!text) return '';
+    const n = text.length;
+    const pieces = [];
+    let copyFrom = 0;
+    let i = 0;
+    while (i < n) {
+      if (STATS_MARKER_CODES.indexOf(text.charCodeAt(i)) === -1) {
+        i++;
+        continue;
       }
-      if (!bottomFound && config.statsBottom) {
-        body.appendParagraph(clockStatsText);
+      const match = matchStatsBlock(text, i);
+      if (!match.found) {
+        i = match.next;
+        continue;
       }
+      pieces.push(text.slice(copyFrom, i));
+      copyFrom = i = match.next;
+    }
+    pieces.push(text.slice(copyFrom));
+    return pieces.join('');
+  }
 
-      // Anywhere stats
-      const finalParas = body.getParagraphs();
-      const ANYWHERE_MARKERS = ['⏳', '⏳️', '⌛️'];
-      const PRIMARY_ANYWHERE_MARKER = '⏳';
-
-      if (config.statsAnywhere === true) {
-        for (let i = 0; i < finalParas.length; i++) {
-          const para = finalParas[i];
-          const paraText = para.getText();
-          const containsMarker = ANYWHERE_MARKERS.some(marker => paraText.includes(marker));
-          const isAlreadyStats = paraText.includes('Last edit:');
-          if (containsMarker && !isAlreadyStats) {
-            para.setText(sandTimerStatsText);
-          }
-        }
-      } else {
-        for (let i = 0; i < finalParas.length; i++) {
-          const text = finalParas[i].getText();
-          if (text.startsWith(PRIMARY_ANYWHERE_MARKER + '\n') ||
-              text.startsWith(PRIMARY_ANYWHERE_MARKER + '\r') ||
-              text.startsWith(PRIMARY_ANYWHERE_MARKER + ' ')) {
-            finalParas[i].setText(PRIMARY_ANYWHERE_MARKER);
-          }
-        }
+  /**
+   * Matches a stats block starting at start. Returns { found: true, next } with next just past
+   * the block (including one trailing '\n'), or { found: false, next } where next is the first
+   * position a block could still start: every marker before it reaches the same 'Last edit:'
+   * line and line breaks, so it would fail the same way. Skipping there keeps the pass linear
+   * on text full of markers or unterminated 'Last edit:' lines.
+   */
+  function matchStatsBlock(text, start) {
+    const n = text.length;
+    let p = start;
+    while (p < n && (STATS_MARKER_CODES.indexOf(text.charCodeAt(p)) !== -1 ||
+                     text.charCodeAt(p) === VARIATION_SELECTOR_16)) {
+      p++;
+    }
+    while (p < n && (text[p] === '\n' || text[p] === '\r' || text[p] === ' ')) p++;
+    if (!text.startsWith('Last edit:', p)) return { found: false, next: p };
+
+    let firstLineEnd = -1;
+    for (let line = 0; line < STATS_BLOCK_MAX_LINES; line++) {
+      while (p < n && text[p] !== '\n' && text[p] !== '\r') p++;
+      if (firstLineEnd === -1) firstLineEnd = p;
+      if (p >= n) break;
+      p += (text[p] === '\r' && text[p + 1] === '\n') ? 2 : 1;
+      if (text.startsWith('Status: ', p)) {
+        while (p < n && text[p] !== '\n' && text[p] !== '\r') p++;
+        return { found: true, next: (p < n && text[p] === '\n') ? p + 1 : p };
       }
+    }
+    return { found: false, next: firstLineEnd };
+  }
 
-      // Persist state
-      lastLiveTimeMs = lastLiveTimeMs !== null ? lastLiveTimeMs : nowMs;
-      props.setProperty(lastChangeTimeKey, String(lastChangeTimeMs));
-      props.setProperty(lastLiveTimeKey, String(lastLiveTimeMs));
-      props.setProperty(longestTimeKey, String(newLongestTime));
-      props.setProperty(lastContentHashKey, currentHash);
+  // Engine used by computeContentHash; override with the 'hashAlgorithm' script property.
+  // Stored hashes record their engine, and a mismatch is treated as "unknown", not as an edit.
+  const HASH_ENGINES = ['fnv64', 'sha256'];
+  const DEFAULT_HASH_ENGINE = 'fnv64';
+  let hashEngineName_ = null;
 
-    } catch (e) {
-      Logger.log('CRITICAL Error in updateStats: ' + e.toString() + ' Stack: ' + e.stack);
+  function getHashEngineName() {
+    if (hashEngineName_ === null) {
+      const configured = PropertiesService.getScriptProperties().getProperty('hashAlgorithm');
+      hashEngineName_ = HASH_ENGINES.indexOf(configured) !== -1 ? configured : DEFAULT_HASH_ENGINE;
     }
+    return hashEngineName_;
+  }
+
+  /**
+   * Hashes cleanText with the configured engine (see getHashEngineName).
+   */
+  function computeContentHash(cleanText) {
+    return getHashEngineName() === 'sha256' ? sha256Hex(cleanText) : fnv64Base64(cleanText);
   }
 
   /**
-   * Returns a hex string of the SHA-256 hash of cleanText.
+   * Returns a hex string of the SHA-256 hash of text.
    */
- function computeContentHash(cleanText) {
-    const blob  = Utilities.newBlob(cleanText || '', 'text/plain');
+  function sha256Hex(text) {
+    const blob  = Utilities.newBlob(text || '', 'text/plain');
     const bytes = Utilities.computeDigest(Utilities.DigestAlgorithm.SHA_256, blob.getBytes());
     return bytes.map(b => ('0' + (b & 0xFF).toString(16)).slice(-2)).join('');
   }
 
-  function debugContentHash(docId) {
-    const props = PropertiesService.getScriptProperties();
-    const lastContentHashKey = 'lastContentHash_' + docId;
-    const storedHash = props.getProperty(lastContentHashKey) || '(none)';
-    const doc = DocumentApp.openById(docId);
-    const cleanText = doc.getBody()
-      .getText()
-      .replace(/[⏰⏳⌛️⏳️][\s\S]*?Status: .*?(?:\n|$)/g, '');
-    const currentHash = computeContentHash(cleanText);
-    Logger.log('Stored hash:  ' + storedHash);
-    Logger.log('Current hash: ' + currentHash);
-    Logger.log('hashChanged? ' + (storedHash !== currentHash));
+  const BASE64_WEB_SAFE = 'ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_';
+
+  /**
+   * 64-bit FNV-1a over UTF-16 code units, in pure JS with four 16-bit limbs
+   * (no blob or byte array). Returned as 11 web-safe base64 characters.
+   */
+  function fnv64Base64(text) {
+    text = text || '';
+    // Offset basis 0xcbf29ce484222325, low limb first
+    let h0 = 0x2325, h1 = 0x8422, h2 = 0x9ce4, h3 = 0xcbf2;
+    for (let i = 0; i < text.length; i++) {
+      h0 ^= text.charCodeAt(i);
+      // Multiply by the FNV prime 0x100000001b3 (limbs 0x01b3, 0, 0x0100, 0)
+      let t0 = h0 * 0x1b3;
+      let t1 = h1 * 0x1b3;
+      let t2 = h2 * 0x1b3 + h0 * 0x100;
+      let t3 = h3 * 0x1b3 + h1 * 0x100;
+      t1 += t0 >>> 16; h0 = t0 & 0xffff;
+      t2 += t1 >>> 16; h1 = t1 & 0xffff;
+      t3 += t2 >>> 16; h2 = t2 & 0xffff;
+      h3 = t3 & 0xffff;
+    }
+    // 64 bits -> 11 base64 digits, most significant first
+    const hi = ((h3 << 16) | h2) >>> 0;
+    const lo = ((h1 << 16) | h0) >>> 0;
+    let out = '';
+    for (let shift = 60; shift >= 0; shift -= 6) {
+      let value;
+      if (shift >= 32) {
+        value = (hi >>> (shift - 32)) & 63;
+      } else if (shift + 6 <= 32) {
+        value = (lo >>> shift) & 63;
+      } else {
+        value = ((hi << (32 - shift)) | (lo >>> shift)) & 63;
+      }
+      out += BASE64_WEB_SAFE[value];
+    }
+    return out;
   }
 
 
 
 
+
   /**
    * Reads a stored string and converts it to a number. Returns null if missing/invalid.
    * (Reuses the existing readNumberProperty helper you already have.)
@@ -330,13 +2110,12 @@ function handleRegisterDoc(token, docId, params) {
 
   function debugContentHash(docId) {
     const props = PropertiesService.getScriptProperties();
-    const lastContentHashKey = 'lastContentHash_' + docId;
-    const storedHash = props.getProperty(lastContentHashKey) || '(none)';
+    const storedHash = readDocState(docId, loadDocRecord(docId)).h || '(none)';
+    const storedBlocks = readContentBlocks(props, 'contentBlocks_' + docId);
     const doc = DocumentApp.openById(docId);
-    const cleanText = doc.getBody()
-      .getText()
-      .replace(/[⏰⏳⌛️⏳️][\s\S]*?Status: .*?(?:\n|$)/g, '');
-    const currentHash = computeContentHash(cleanText);
+    const texts = contentParagraphTexts(buildParagraphIndex(doc.getBody()));
+    const currentHash = contentRootHash(buildContentBlocks(texts, storedBlocks ? storedBlocks.size : CONTENT_BLOCK_SIZE));
+    Logger.log('Hash engine:  ' + getHashEngineName() + ' (stored: ' + (storedBlocks ? storedBlocks.alg || 'sha256' : '(none)') + ')');
     Logger.log('Stored hash:  ' + storedHash);
     Logger.log('Current hash: ' + currentHash);
     Logger.log('hashChanged? ' + (storedHash !== currentHash));
@@ -355,13 +2134,561 @@ function readNumberProperty(props, key) {
   Logger.log('Invalid numeric property for ' + key + ': ' + raw);
   return null;
 }
+// ==================== STATS RENDER BACKENDS ====================
+
+/*
+ * updateStats decides what each stats paragraph should say; a renderer applies it.
+ *   documentApp (default): every change is an immediate DocumentApp call.
+ *   docsApi: changes are queued against the paragraphs' scan-time positions and sent as a
+ *            single Docs API batchUpdate with index ranges when updateStats commits. Needs the
+ *            Docs advanced service (Services > Google Docs API) enabled for the project.
+ * Pick one per deployment with the 'renderBackend' script property; verifyRenderBackends
+ * checks that both produce the same document.
+ */
+const RENDER_BACKENDS = ['documentApp', 'docsApi'];
+let renderBackendName_ = null;
+
+function getRenderBackendName() {
+  if (renderBackendName_ === null) {
+    const configured = PropertiesService.getScriptProperties().getProperty('renderBackend');
+    renderBackendName_ = RENDER_BACKENDS.indexOf(configured) !== -1 ? configured : 'documentApp';
+    if (renderBackendName_ === 'docsApi' && typeof Docs === 'undefined') {
+      Logger.log('renderBackend: Docs advanced service is not enabled, using documentApp');
+      renderBackendName_ = 'documentApp';
+    }
+  }
+  return renderBackendName_;
+}
+
+/**
+ * Returns { writes, skippedWrites, setText, remove, insertTop, append, commit } for doc.
+ * remove(entry) returns true if the paragraph is detached (false: cleared, see safeRemovePara);
+ * insertTop/append return the index entry for the new paragraph.
+ */
+function createStatsRenderer(doc, structure) {
+  const renderer = { writes: 0, skippedWrites: 0 };
+
+  if (!structure) {
+    const body = doc.getBody();
+    renderer.setText = (entry, text) => { entry.para.setText(text); };
+    renderer.remove = (entry) => safeRemovePara(entry.para);
+    renderer.insertTop = (text) => classifyParagraph(body.insertParagraph(0, text));
+    renderer.append = (text) => classifyParagraph(body.appendParagraph(text));
+    renderer.commit = () => {};
+    return renderer;
+  }
+
+  const ops = [];
+  const queueInsert = (type, text) => {
+    const entry = describeParagraph(null, text, true);
+    entry.op = { type: type, text: text };
+    ops.push(entry.op);
+    return entry;
+  };
+  renderer.setText = (entry, text) => {
+    if (entry.op) {
+      entry.op.text = text;   // not written yet: just change what will be inserted
+    } else {
+      ops.push({ type: 'replace', ordinal: entry.ordinal, text: text });
+    }
+  };
+  renderer.remove = (entry) => {
+    if (entry.op) {
+      entry.op.type = 'skip';
+      return true;
+    }
+    const lastChild = entry.range.lastInSection;
+    ops.push({ type: lastChild ? 'clear' : 'remove', ordinal: entry.ordinal });
+    return !lastChild;
+  };
+  renderer.insertTop = (text) => queueInsert('insertTop', text);
+  renderer.append = (text) => queueInsert('append', text);
+  renderer.commit = () => commitDocsApiRender(ops, structure);
+  return renderer;
+}
+
+/**
+ * Sends the queued ops as one batchUpdate, pinned to the revision the structure was read at,
+ * so an edit made since the read rejects the batch rather than shifting its ranges. Anything
+ * the index-based requests can't express safely (a removal next to a table, a doc starting with
+ * a table, an insert next to a list item) is applied through DocumentApp instead. A rejected
+ * batch is an error: the doc changed under us and the next run starts over.
+ */
+function commitDocsApiRender(ops, structure) {
+  const liveOps = ops.filter(op => op.type !== 'skip');
+  if (liveOps.length === 0) return;
+
+  const docId = structure.docId;
+  const requests = buildRenderRequests(structure, liveOps);
+  if (requests) {
+    try {
+      if (requests.length > 0) {
+        Docs.Documents.batchUpdate({
+          requests: requests,
+          writeControl: { requiredRevisionId: structure.revisionId }
+        }, docId);
+      }
+      return;
+    } catch (e) {
+      // A writeControl rejection just means someone is typing; callers retry rather than back off
+      e.revisionConflict = /revision/i.test(String(e));
+      throw e;
+    }
+  }
+  Logger.log('commitDocsApiRender: structure not batchable for ' + docId + ', using DocumentApp');
+  applyRenderOpsWithDocumentApp(docId, liveOps);
+}
+
+// Fields mask for readDocStructure: paragraph ranges, text runs and whether the paragraph is a
+// list item. No styles or inline objects are transferred.
+const DOC_STRUCTURE_FIELDS = (() => {
+  const contentFields = 'content(startIndex,endIndex,paragraph(bullet(listId),elements(textRun(content)))';
+  return 'revisionId,body(' + contentFields + ',table(tableRows(tableCells(' + contentFields + '))))))';
+})();
+
+/**
+ * Returns { docId, revisionId, paragraphs, startsWithParagraph, bodyStart }, where paragraphs are
+ * [{ start, end, lastInSection, beforeNonParagraph, isParagraph, text }] in body.getParagraphs()
+ * order. text is what DocumentApp's getText() would return; isParagraph is false for list items,
+ * which DocumentApp reports as LIST_ITEM rather than PARAGRAPH.
+ */
+function readDocStructure(docId) {
+  const document = Docs.Documents.get(docId, { fields: DOC_STRUCTURE_FIELDS });
+  const content = (document.body || {}).content || [];
+  const paragraphs = [];
+  collectStructureParagraphs(content, paragraphs);
+  // The leading section break comes back as just { endIndex: 1 }: the mask doesn't ask for
+  // sectionBreak and its startIndex of 0 is left out
+  const first = content.find(element => element.paragraph || element.table || Number.isFinite(element.startIndex));
+  return {
+    docId: docId,
+    revisionId: document.revisionId,
+    paragraphs: paragraphs,
+    startsWithParagraph: !!(first && first.paragraph),
+    bodyStart: first ? first.startIndex : 1
+  };
+}
+
+function collectStructureParagraphs(content, out) {
+  content.forEach((element, i) => {
+    if (element.paragraph) {
+      const next = content[i + 1];
+      out.push({
+        start: element.startIndex,
+        end: element.endIndex,
+        lastInSection: !next,
+        beforeNonParagraph: !!next && !next.paragraph,
+        isParagraph: !element.paragraph.bullet,
+        // Runs end with the paragraph's newline; soft line breaks come back as vertical tabs
+        text: (element.paragraph.elements || [])
+          .map(run => (run.textRun && run.textRun.content) || '')
+          .join('')
+          .replace(/\n$/, '')
+          .replace(/\u000b/g, '\r')
+      });
+    } else if (element.table) {
+      (element.table.tableRows || []).forEach(row => {
+        (row.tableCells || []).forEach(cell => collectStructureParagraphs(cell.content || [], out));
+      });
+    }
+  });
+}
+
+/**
+ * Index-based requests for the ops, or null if one can't be expressed safely.
+ * Ranged edits run from the end of the doc backwards so earlier indexes stay valid;
+ * the appended paragraph goes first and the top insert last for the same reason.
+ */
+function buildRenderRequests(structure, ops) {
+  const requests = [];
+  const ranged = [];
+  const tops = [];
+  // A paragraph inserted next to a list item would inherit its bullet; DocumentApp's wouldn't
+  const first = structure.paragraphs[0];
+  const last = structure.paragraphs[structure.paragraphs.length - 1];
+
+  for (let i = 0; i < ops.length; i++) {
+    const op = ops[i];
+    if (op.type === 'append') {
+      if (last && !last.isParagraph) return null;
+      requests.push({ insertText: { endOfSegmentLocation: {}, text: '\n' + docsApiText(op.text) } });
+    } else if (op.type === 'insertTop') {
+      if (!structure.startsWithParagraph || !first.isParagraph) return null;
+      tops.push(op);
+    } else {
+      const para = structure.paragraphs[op.ordinal];
+      if (!para) return null;
+      if (op.type === 'remove' && (para.lastInSection || para.beforeNonParagraph)) return null;
+      ranged.push({ op: op, para: para });
+    }
+  }
+
+  ranged.sort((a, b) => b.para.start - a.para.start);
+  ranged.forEach(({ op, para }) => {
+    const contentEnd = para.end - 1;   // keep the paragraph's own newline unless removing it
+    if (op.type === 'remove') {
+      requests.push({ deleteContentRange: { range: { startIndex: para.start, endIndex: para.end } } });
+      return;
+    }
+    if (contentEnd > para.start) {
+      requests.push({ deleteContentRange: { range: { startIndex: para.start, endIndex: contentEnd } } });
+    }
+    if (op.type === 'replace' && op.text) {
+      requests.push({ insertText: { location: { index: para.start }, text: docsApiText(op.text) } });
+    }
+  });
+
+  tops.forEach(op => {
+    requests.push({ insertText: { location: { index: structure.bodyStart }, text: docsApiText(op.text) + '\n' } });
+  });
+  return requests;
+}
+
+// A '\n' sent to the Docs API starts a new paragraph; DocumentApp's setText keeps it inside
+// the paragraph as a line break, which the API spells as a vertical tab.
+function docsApiText(text) {
+  return String(text).replace(/\r\n|\r|\n/g, '\u000b');
+}
+
+function applyRenderOpsWithDocumentApp(docId, ops) {
+  const body = DocumentApp.openById(docId).getBody();
+  const paras = body.getParagraphs();
+  ops.forEach(op => {
+    switch (op.type) {
+      case 'replace':
+        paras[op.ordinal].setText(op.text);
+        break;
+      case 'remove':
+      case 'clear':
+        safeRemovePara(paras[op.ordinal]);
+        break;
+      case 'insertTop':
+        body.insertParagraph(0, op.text);
+        break;
+      case 'append':
+        body.appendParagraph(op.text);
+        break;
+    }
+  });
+}
+
+/**
+ * Renders a copy of the doc with each backend and compares the resulting paragraphs.
+ * Digits are masked because the two renders happen seconds apart. Run from the editor.
+ */
+function verifyRenderBackends(docId, token) {
+  if (typeof Docs === 'undefined') return { error: 'Enable the Docs advanced service first' };
+  const config = getDocConfig(token, docId);
+  const source = DriveApp.getFileById(docId);
+  const outputs = {};
+
+  RENDER_BACKENDS.forEach(backend => {
+    const copyId = source.makeCopy('Render check (' + backend + ') ' + source.getName()).getId();
+    try {
+      renderBackendName_ = backend;
+      const result = updateStats(DocumentApp.openById(copyId), config);
+      if (result.error) throw new Error(backend + ': ' + result.error);
+      outputs[backend] = DocumentApp.openById(copyId).getBody().getParagraphs()
+        .map(para => para.getText().replace(/\d/g, '#'));
+    } finally {
+      renderBackendName_ = null;
+      DriveApp.getFileById(copyId).setTrashed(true);
+      const props = PropertiesService.getScriptProperties();
+      props.deleteProperty(docRecordKey(copyId));
+      props.deleteProperty('contentBlocks_' + copyId);
+      invalidateDocRecordCache(copyId);
+      forgetDocRecord(copyId);
+    }
+  });
+
+  const expected = outputs.documentApp;
+  const actual = outputs.docsApi;
+  let firstDifference = -1;
+  for (let i = 0; i < Math.max(expected.length, actual.length); i++) {
+    if (expected[i] !== actual[i]) {
+      firstDifference = i;
+      break;
+    }
+  }
+  const report = {
+    match: firstDifference === -1,
+    paragraphs: expected.length,
+    firstDifference: firstDifference === -1 ? null :
+      { paragraph: firstDifference, documentApp: expected[firstDifference], docsApi: actual[firstDifference] }
+  };
+  Logger.log('verifyRenderBackends: ' + JSON.stringify(report));
+  return report;
+}
+
+// ==================== PER-DOC STATE RECORD ====================
+
+/*
+ * Everything the script keeps for a doc lives in one JSON property, doc_<docId>:
+ *   { v: 1,
+ *     cfg: { <token>: { statsTop, statsBottom, statsAnywhere, timezone, granularity } },
+ *     st:  { h: content hash, c: last change ms, l: longest time away ms,
+ *            lv: last live ms, fp: content fingerprint, nd: next refresh due ms },
+ *     rk:  recent append idempotency keys [[key, ms, queueSeq?], ...],
+ *     q:   async append queue { next: next seq to assign, applied: last seq applied },
+ *     wb:  due wheel bucket the doc is filed under (see scheduleDocRefresh),
+ *     br:  circuit breaker while refreshes fail { f: consecutive failures, until: next probe ms,
+ *          q: quarantined, e: last error } }
+ * It is read with one getProperty and written with one setProperties call. The block hash
+ * vector (contentBlocks_<docId>) stays separate because it is large and only read on a full hash.
+ * Records written by an older layout (config_*, lastContentHash_*, ...) migrate lazily.
+ *
+ * CacheService sits in front of PropertiesService. Reads try the script cache first
+ * (getAll for sweeps). Writes always refresh the cache, but reach PropertiesService only when
+ * something durable changed (config, content hash, last change time, block vector) or the
+ * persisted copy is older than DOC_RECORD_WRITE_BEHIND_MS. The deferred fields (longest time,
+ * last live, fingerprint check time) are recomputed from the last change time on the next run,
+ * so losing a cached copy costs at most a little Longest time away precision.
+ */
+const DOC_RECORD_VERSION = 1;
+const DOC_RECORD_CACHE_TTL_S = 10 * 60;
+const DOC_RECORD_WRITE_BEHIND_MS = 10 * 60 * 1000;
+const LEGACY_STATE_PREFIXES = ['lastContentHash_', 'lastChangeTime_', 'longestTime_', 'lastLiveTime_', 'lastFingerprint_'];
+
+let docRecords_ = {};       // records loaded during this execution, by docId
+let legacyKeysByDoc_ = {};  // legacy keys to delete once the record has been saved
+
+function docRecordKey(docId) {
+  return 'doc_' + docId;
+}
+
+function loadDocRecord(docId) {
+  if (docRecords_[docId]) return docRecords_[docId];
+  const key = docRecordKey(docId);
+  let raw = CacheService.getScriptCache().get(key);
+  const fromCache = raw !== null;
+  if (!fromCache) raw = PropertiesService.getScriptProperties().getProperty(key);
+
+  const record = parseDocRecord(docId, raw);
+  if (!fromCache && raw) {
+    CacheService.getScriptCache().put(key, raw, DOC_RECORD_CACHE_TTL_S);
+  }
+  docRecords_[docId] = record;
+  return record;
+}
+
+/**
+ * Warms the per-execution record map for a sweep with a single cache getAll.
+ * Cache misses are left for loadDocRecord to fetch from PropertiesService on demand.
+ */
+function preloadDocRecords(docIds) {
+  const keys = docIds.filter(docId => !docRecords_[docId]).map(docRecordKey);
+  for (let start = 0; start < keys.length; start += 100) {
+    const cached = CacheService.getScriptCache().getAll(keys.slice(start, start + 100));
+    Object.keys(cached).forEach(key => {
+      const docId = key.substring('doc_'.length);
+      docRecords_[docId] = parseDocRecord(docId, cached[key]);
+    });
+  }
+}
+
+function parseDocRecord(docId, raw) {
+  let record = null;
+  if (raw) {
+    try {
+      record = JSON.parse(raw);
+    } catch (e) {
+      Logger.log('Invalid doc record for ' + docId + ': ' + raw);
+    }
+  }
+  if (!record || record.v !== DOC_RECORD_VERSION) {
+    record = { v: DOC_RECORD_VERSION, cfg: {}, st: null };
+  }
+  record.cfg = record.cfg || {};
+  return record;
+}
+
+/**
+ * Saves the record. With persist false the write goes to the cache only, unless the
+ * persisted copy is older than DOC_RECORD_WRITE_BEHIND_MS or legacy keys are waiting.
+ * Persisting is one setProperties call (record plus any extra properties), after which
+ * absorbed legacy keys are removed.
+ */
+function saveDocRecord(docId, record, extraProps, persist) {
+  const key = docRecordKey(docId);
+  const legacyKeys = legacyKeysByDoc_[docId];
+  const nowMs = Date.now();
+  const hasExtras = !!extraProps && Object.keys(extraProps).length > 0;
+  docRecords_[docId] = record;
+
+  if (persist === false && !hasExtras && !legacyKeys &&
+      record.pAt && nowMs - record.pAt < DOC_RECORD_WRITE_BEHIND_MS) {
+    CacheService.getScriptCache().put(key, JSON.stringify(record), DOC_RECORD_CACHE_TTL_S);
+    return;
+  }
+
+  record.pAt = nowMs;
+  const serialized = JSON.stringify(record);
+  const toWrite = extraProps || {};
+  toWrite[key] = serialized;
+  const props = PropertiesService.getScriptProperties();
+  props.setProperties(toWrite);
+  CacheService.getScriptCache().put(key, serialized, DOC_RECORD_CACHE_TTL_S);
+
+  if (legacyKeys) {
+    delete legacyKeysByDoc_[docId];
+    legacyKeys.forEach(legacyKey => props.deleteProperty(legacyKey));
+  }
+}
+
+/**
+ * Drops a doc's cached record so the next read comes from PropertiesService.
+ */
+function invalidateDocRecordCache(docId) {
+  CacheService.getScriptCache().remove(docRecordKey(docId));
+}
+
+/**
+ * Timer state from the record, migrating the per-field legacy properties on first use.
+ */
+function readDocState(docId, record) {
+  if (record.st) return record.st;
+  const props = PropertiesService.getScriptProperties();
+  const legacyHash = props.getProperty('lastContentHash_' + docId);
+  if (!legacyHash) return {};
+
+  markLegacyKeys(docId, LEGACY_STATE_PREFIXES.map(prefix => prefix + docId));
+  return {
+    h: legacyHash,
+    c: readNumberProperty(props, 'lastChangeTime_' + docId),
+    l: readNumberProperty(props, 'longestTime_' + docId),
+    lv: readNumberProperty(props, 'lastLiveTime_' + docId),
+    fp: readFingerprint(props, 'lastFingerprint_' + docId)
+  };
+}
+
+function markLegacyKeys(docId, keys) {
+  legacyKeysByDoc_[docId] = (legacyKeysByDoc_[docId] || []).concat(keys);
+}
+
 // ==================== HELPER FUNCTIONS ====================
 
+/**
+ * Returns a copy of the token's config for docId from the doc record.
+ * Falls back to (and lazily migrates) the legacy config_<token>_<docId> key, then to defaults.
+ */
 function getDocConfig(token, docId) {
-  const configKey = 'config_' + token + '_' + docId;
-  const configStr = PropertiesService.getScriptProperties().getProperty(configKey);
-  if (configStr) return JSON.parse(configStr);
-  return { statsTop: false, statsBottom: true, statsAnywhere: false, timezone: 'UTC' };
+  const record = loadDocRecord(docId);
+  if (!record.cfg[token]) {
+    const configKey = 'config_' + token + '_' + docId;
+    const configStr = PropertiesService.getScriptProperties().getProperty(configKey);
+    if (configStr) {
+      record.cfg[token] = JSON.parse(configStr);
+      markLegacyKeys(docId, [configKey]);
+    } else {
+      record.cfg[token] = { statsTop: false, statsBottom: true, statsAnywhere: false, timezone: 'UTC', granularity: 'seconds', coalesceSeconds: 0, noteLayout: 'standard' };
+    }
+  }
+  return JSON.parse(JSON.stringify(record.cfg[token]));
+}
+
+// First token the doc has a config under, or null
+function storedDocToken(record) {
+  return Object.keys(record.cfg)[0] || null;
+}
+
+/**
+ * Persists a config change immediately (with any state still pending write-behind)
+ * and invalidates the cached record.
+ */
+function saveDocConfig(token, docId, config) {
+  const record = loadDocRecord(docId);
+  record.cfg[token] = JSON.parse(JSON.stringify(config));
+  saveDocRecord(docId, record);
+  invalidateDocRecordCache(docId);
+}
+
+/**
+ * Copies recognised stats settings from a request (params or JSON payload) onto config.
+ */
+function applyConfigSettings(config, settingsSource) {
+  if (settingsSource.statsTop !== undefined) {
+    config.statsTop = settingsSource.statsTop === true || settingsSource.statsTop === 'true';
+  }
+  if (settingsSource.statsBottom !== undefined) {
+    config.statsBottom = settingsSource.statsBottom === true || settingsSource.statsBottom === 'true';
+  }
+  if (settingsSource.statsAnywhere !== undefined) {
+    config.statsAnywhere = settingsSource.statsAnywhere === true || settingsSource.statsAnywhere === 'true';
+  }
+  if (settingsSource.timezone) config.timezone = settingsSource.timezone;
+  if (DISPLAY_GRANULARITIES.indexOf(settingsSource.granularity) !== -1) {
+    config.granularity = settingsSource.granularity;
+  }
+  if (NOTE_LAYOUTS.indexOf(settingsSource.noteLayout) !== -1) {
+    config.noteLayout = settingsSource.noteLayout;
+  }
+  if (settingsSource.coalesceSeconds !== undefined) {
+    const seconds = Math.floor(Number(settingsSource.coalesceSeconds));
+    config.coalesceSeconds = seconds > 0 ? Math.min(seconds, COALESCE_MAX_SECONDS) : 0;
+  }
+  return config;
+}
+
+// Recent append keys kept per doc (record field rk: [[key, timeMs], ...]).
+// Client idempotency keys are remembered for a day; without one, identical content
+// within CONTENT_DEDUPE_WINDOW_MS is treated as a retry.
+const IDEMPOTENCY_MAX_KEYS = 25;
+const IDEMPOTENCY_KEY_TTL_MS = 24 * 60 * 60 * 1000;
+const CONTENT_DEDUPE_WINDOW_MS = 2 * 60 * 1000;
+
+function appendDedupeKey(content, clientKey) {
+  return clientKey ? 'k:' + String(clientKey).slice(0, 64) : 'c:' + fnv64Base64(content);
+}
+
+function findRecentAppend(record, key, nowMs) {
+  const ttl = key.startsWith('c:') ? CONTENT_DEDUPE_WINDOW_MS : IDEMPOTENCY_KEY_TTL_MS;
+  return (record.rk || []).find(entry => entry[0] === key && nowMs - entry[1] < ttl) || null;
+}
+
+/**
+ * Records an append key; seq is the queue sequence number for queued appends.
+ */
+function rememberAppend(record, key, nowMs, seq) {
+  const recent = (record.rk || []).filter(entry => entry[0] !== key && nowMs - entry[1] < IDEMPOTENCY_KEY_TTL_MS);
+  recent.push(seq ? [key, nowMs, seq] : [key, nowMs]);
+  record.rk = recent.slice(-IDEMPOTENCY_MAX_KEYS);
+}
+
+/**
+ * Appends several notes in order: the whole block is built first, then inserted at
+ * one position (above the bottom stats block when statsBottom is on).
+ */
+function appendNotes(body, config, contents) {
+  const paras = body.getParagraphs();
+  let insertAt = paras.length;
+  if (config.statsBottom && paras.length > 0 && isStatsPara(paras[paras.length - 1])) {
+    insertAt = paras.length - 1;
+  }
+  insertNoteBlock(body, insertAt, buildNoteBlock(contents, config.noteLayout));
+}
+
+/**
+ * Returns the paragraph texts for a run of notes.
+ *   standard: separator, blank, one paragraph per content line, blank
+ *   compact:  one paragraph per note, spaced with in-paragraph line breaks
+ */
+function buildNoteBlock(contents, layout) {
+  const block = [];
+  contents.forEach(content => {
+    const lines = String(content).split(/\r\n|\r|\n/);
+    if (layout === 'compact') {
+      block.push('—\n\n' + lines.join('\n') + '\n');
+    } else {
+      block.push('—', '');
+      lines.forEach(line => block.push(line));
+      block.push('');
+    }
+  });
+  return block;
+}
+
+function insertNoteBlock(body, insertAt, texts) {
+  texts.forEach((text, i) => body.insertParagraph(insertAt + i, text));
 }
 
 function isStatsPara(para) {
@@ -371,31 +2698,70 @@ function isStatsPara(para) {
   } catch (e) { return false; }
 }
 
+/**
+ * Removes a paragraph, or clears it when it is the last child (Docs refuses to remove that one).
+ * Returns true only if the paragraph was actually detached.
+ */
 function safeRemovePara(para) {
   try {
     const parent = para.getParent();
     const index = parent.getChildIndex(para);
     if (index === parent.getNumChildren() - 1) {
       para.clear(); 
-    } else {
-      para.removeFromParent();
+      return false;
     }
+    para.removeFromParent();
+    return true;
   } catch (e) {
     try { para.setText(''); } catch (e2) {}
+    return false;
   }
 }
 
-function formatElapsedTime(ms) {
-    if (ms < 1000) return "0 sec";
+/**
+ * Formats a duration down to unitMs (1 sec by default); smaller remainders are dropped.
+ */
+function formatElapsedTime(ms, unitMs) {
     const sec = 1000, min = 60 * sec, hour = 60 * min, day = 24 * hour;
+    unitMs = unitMs || sec;
     let parts = [];
     const days = Math.floor(ms / day); if (days > 0) parts.push(days + (days > 1 ? ' days' : ' day')); ms %= day;
-    const hours = Math.floor(ms / hour); if (hours > 0) parts.push(hours + (hours > 1 ? ' hours' : ' hour')); ms %= hour;
-    const minutes = Math.floor(ms / min); if (minutes > 0) parts.push(minutes + ' min'); ms %= min;
-    const seconds = Math.floor(ms / sec); if (seconds > 0 || parts.length === 0) parts.push(seconds + ' sec');
+    if (unitMs <= hour) { const hours = Math.floor(ms / hour); if (hours > 0) parts.push(hours + (hours > 1 ? ' hours' : ' hour')); ms %= hour; }
+    if (unitMs <= min) { const minutes = Math.floor(ms / min); if (minutes > 0) parts.push(minutes + ' min'); ms %= min; }
+    if (unitMs <= sec) { const seconds = Math.floor(ms / sec); if (seconds > 0) parts.push(seconds + ' sec'); }
+    if (parts.length === 0) parts.push(unitMs <= sec ? '0 sec' : unitMs <= min ? '0 min' : unitMs <= hour ? '0 hours' : '0 days');
     return parts.join(', ');
 }
 
+/**
+ * Earliest time the rendered stats text would change with no edit: the next tick of the
+ * elapsed-time display unit, or the Live -> Away flip.
+ */
+function nextVisibleChangeMs(lastChangeMs, nowMs, granularity) {
+    const elapsed = Math.max(nowMs - lastChangeMs, 0);
+    const unit = displayUnitMs(granularity, elapsed);
+    let next = lastChangeMs + (Math.floor(elapsed / unit) + 1) * unit;
+    if (elapsed < LIVE_WINDOW_MS) next = Math.min(next, lastChangeMs + LIVE_WINDOW_MS);
+    return next;
+}
+
+/**
+ * Smallest unit shown for a duration under a display granularity.
+ * 'adaptive' shows seconds while Live, then coarser units as the time grows, so most
+ * refreshes of an idle doc render identical text and are skipped as no-op writes.
+ */
+function displayUnitMs(granularity, ms) {
+    const sec = 1000, min = 60 * sec, hour = 60 * min, day = 24 * hour;
+    if (granularity === 'minutes') return min;
+    if (granularity === 'adaptive') {
+      if (ms < LIVE_WINDOW_MS) return sec;
+      if (ms < hour) return min;
+      if (ms < 7 * day) return hour;
+      return day;
+    }
+    return sec;
+}
+
 function createResponse(data) {
   return ContentService.createTextOutput(JSON.stringify(data)).setMimeType(ContentService.MimeType.JSON);
 }
@@ -482,8 +2848,9 @@ function testEnableSandTimerOnDoc2() {
 function inspectConfigForDoc(docId) {
   try {
     const token = '92b2bedb-1371-4aaf-be7f-74bb8f3078bd'; // Your token
-    const configKey = 'config_' + token + '_' + docId;
-    const configStr = PropertiesService.getScriptProperties().getProperty(configKey);
+    const record = loadDocRecord(docId);
+    const configStr = record.cfg[token] ? JSON.stringify(record.cfg[token]) :
+        PropertiesService.getScriptProperties().getProperty('config_' + token + '_' + docId);
 
     if (configStr) {
       Logger.log("Found saved settings for Doc ID " + docId);
@@ -514,9 +2881,7 @@ function debugStatsDelta(docId) {
     const lastContentKey = 'lastContent_' + docId;
     const saved = props.getProperty(lastContentKey) || '';
     const doc = DocumentApp.openById(docId);
-    const cleanText = doc.getBody()
-      .getText()
-      .replace(/[⏰⏳⌛️⏳️][\s\S]*?Status: .*?(?:\n|$)/g, '');
+    const cleanText = stripStatsBlocks(doc.getBody().getText());
     const difference = cleanText.length - saved.length;
     Logger.log('Saved length: ' + saved.length);
     Logger.log('Current length: ' + cleanText.length);
@@ -540,9 +2905,7 @@ function debugCleanTextDoc1() {
 
 function debugCleanText(docId) {
     const doc = DocumentApp.openById(docId);
-    const cleanText = doc.getBody()
-      .getText()
-      .replace(/[⏰⏳⌛️⏳️][\s\S]*?Status: .*?(?:\n|$)/g, '');
+    const cleanText = stripStatsBlocks(doc.getBody().getText());
     Logger.log('Clean text length: ' + cleanText.length);
     Logger.log('Clean text sample:\n' + cleanText.substring(0, Math.min(200, cleanText.length)));
   }